@@ -7,15 +7,26 @@
 
 #include "point.h"
 
+/*
+ * Directions are ordered clockwise so that turning right adds 1 and
+ * turning left adds 3 (mod 4).
+ */
+enum ant_direction {
+    ANT_LEFT,
+    ANT_UP,
+    ANT_RIGHT,
+    ANT_DOWN
+};
+
 typedef struct {
     point pos;
-    point dir;
+    int dir;
     point screen_pos;
 } ant;
 
+extern const point ant_dir_offsets[4];
+
 void center_ant(ant *a, int row, int col, point *grid_offset);
-void render_ant(ant *a, int row, int col, point *grid_offset);
-void rotate_ant(ant *a, int tile_value, char *pattern);
 void set_ant_dir(ant *a, char dir);
 
 #endif
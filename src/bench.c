@@ -0,0 +1,320 @@
+/*
+ * bench.c
+ *
+ * Benchmark of the stepping engines. Runs a fixed set of patterns for a
+ * fixed number of steps on every backend and prints the results as JSON,
+ * so that throughput can be compared between releases.
+ *
+ * Usage: langtons_ant_bench [STEPS]
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "ant.h"
+#include "grid.h"
+#include "hashlife.h"
+#include "highway.h"
+#include "point.h"
+#include "rule.h"
+
+#define DEFAULT_BENCH_STEPS 10000000ULL
+
+/*
+ * A backend advances a fresh ant from step 0 and reports how many steps
+ * it managed.
+ */
+typedef struct {
+    char *name;
+    int (*run)(rule *r, ant *a, unsigned long long steps,
+            unsigned long long *done);
+} bench_backend;
+
+/*
+ * Result of one case, passed from the child process that ran it.
+ */
+typedef struct {
+    int status;
+    unsigned long long steps;
+    double seconds;
+    long long cache_misses;
+    point pos;
+} bench_result;
+
+static int run_grid(rule *r, ant *a, unsigned long long steps,
+        unsigned long long *done)
+{
+    /*
+     * Step the ant one update_grid call at a time.
+     */
+    grid g;
+    int status = 0;
+
+    init_grid(&g, choose_tile_bits(r->colors));
+    for (*done = 0; *done < steps; (*done)++) {
+        if (update_grid(&g, a, r) != 0) {
+            status = -1;
+            break;
+        }
+    }
+    free_grid(&g);
+    return status;
+}
+
+static int run_kernel(rule *r, ant *a, unsigned long long steps,
+        unsigned long long *done)
+{
+    /*
+     * Step the ant in one step_grid call, which picks the fastest kernel
+     * for the pattern.
+     */
+    grid g;
+    int status;
+
+    *done = 0;
+    init_grid(&g, choose_tile_bits(r->colors));
+    status = step_grid(&g, a, r, done, steps);
+    free_grid(&g);
+    return status;
+}
+
+static int run_highway(rule *r, ant *a, unsigned long long steps,
+        unsigned long long *done)
+{
+    /*
+     * Step the ant with highway detection and fast-forward.
+     */
+    grid g;
+    highway h;
+    int status;
+
+    *done = 0;
+    init_grid(&g, choose_tile_bits(r->colors));
+    init_highway(&h);
+    status = advance_ant(&g, a, r, &h, done, steps);
+    free_grid(&g);
+    return status;
+}
+
+static int run_hashlife(rule *r, ant *a, unsigned long long steps,
+        unsigned long long *done)
+{
+    /*
+     * Step the ant on the memoized quadtree, finishing on the grid if the
+     * quadtree outgrows its memory cap.
+     */
+    hl_world w;
+    grid g;
+    int status;
+
+    *done = 0;
+    if (init_hashlife(&w) != 0) {
+        return -1;
+    }
+    status = advance_hashlife(&w, a, r, done, steps);
+    if (status > 0) {
+        init_grid(&g, choose_tile_bits(r->colors));
+        status = copy_hashlife(&w, &g);
+        free_hashlife(&w);
+        if (status == 0) {
+            status = step_grid(&g, a, r, done, steps - *done);
+        }
+        free_grid(&g);
+        return status;
+    }
+    free_hashlife(&w);
+    return status;
+}
+
+static const bench_backend backends[] = {
+    {"grid", run_grid},
+    {"kernel", run_kernel},
+    {"highway", run_highway},
+    {"hashlife", run_hashlife}
+};
+#define NUM_BACKENDS (int) (sizeof(backends) / sizeof(backends[0]))
+
+static char *patterns[] = {
+    "RL",
+    "RLLR",
+    "LRRRRRLLR",
+    "RRLLLRLLLRRR",
+    // Sixteen colors, for 4 bit tiles
+    "LRRRRRLLRRLRLLRL"
+};
+#define NUM_PATTERNS (int) (sizeof(patterns) / sizeof(patterns[0]))
+
+static int open_cache_counter(void)
+{
+    /*
+     * Open a counter of the cache misses of this process.
+     *
+     * return - File descriptor of the counter, or -1 if the system does
+     *   not provide one
+     */
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void run_case(const bench_backend *b, char *pattern,
+        unsigned long long steps, bench_result *res)
+{
+    /*
+     * Run one pattern on one backend and measure it.
+     *
+     * param b - Backend to run
+     * param pattern - Pattern of the ant
+     * param steps - Number of steps to run
+     * param res - Pointer to the result to fill in
+     */
+    struct timespec start, end;
+    int counter = open_cache_counter();
+    rule r;
+    ant a;
+
+    set_point(&a.pos, 0, 0);
+    set_ant_dir(&a, 'L');
+    compile_rule(&r, pattern);
+#ifdef __linux__
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    res->status = b->run(&r, &a, steps, &res->steps);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    res->cache_misses = -1;
+#ifdef __linux__
+    if (counter >= 0) {
+        long long count;
+
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &count, sizeof(count)) == sizeof(count)) {
+            res->cache_misses = count;
+        }
+        close(counter);
+    }
+#endif
+    res->seconds = (end.tv_sec - start.tv_sec) +
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+    res->pos = a.pos;
+}
+
+static int bench_case(const bench_backend *b, char *pattern,
+        unsigned long long steps, bench_result *res, long *peak_rss)
+{
+    /*
+     * Run one case in a child process, so that its peak memory use is not
+     * mixed up with the cases before it.
+     *
+     * param b - Backend to run
+     * param pattern - Pattern of the ant
+     * param steps - Number of steps to run
+     * param res - Pointer to the result to fill in
+     * param peak_rss - Pointer to the child's peak resident set in KiB
+     * return - 0 on success, -1 if the child could not be run
+     */
+    struct rusage usage;
+    int fds[2];
+    int wstatus;
+    pid_t pid;
+
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    fflush(stdout);
+    if ((pid = fork()) < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        run_case(b, pattern, steps, res);
+        _exit(write(fds[1], res, sizeof(*res)) == sizeof(*res) ? 0 : 1);
+    }
+    close(fds[1]);
+    if (read(fds[0], res, sizeof(*res)) != sizeof(*res)) {
+        res->status = -1;
+    }
+    close(fds[0]);
+    while (wait4(pid, &wstatus, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    // Linux reports ru_maxrss in KiB
+    *peak_rss = usage.ru_maxrss;
+    return WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long long steps = DEFAULT_BENCH_STEPS;
+    int first = 1;
+    char *end;
+
+    if (argc > 2 || (argc == 2 && ((steps = strtoull(argv[1], &end, 10)) ==
+                    0 || *end != '\0'))) {
+        fprintf(stderr, "Usage: langtons_ant_bench [STEPS]\n");
+        return 1;
+    }
+
+    printf("{\n  \"steps\": %llu,\n  \"layout\": \"%s\",\n  \"cases\": [",
+            steps, TILE_LAYOUT_MORTON ? "morton" : "row-major");
+    for (int i = 0; i < NUM_PATTERNS; i++) {
+        for (int j = 0; j < NUM_BACKENDS; j++) {
+            bench_result res;
+            long peak_rss = 0;
+            int ok = bench_case(&backends[j], patterns[i], steps, &res,
+                    &peak_rss) == 0 && res.status == 0;
+
+            printf("%s\n    {\"pattern\": \"%s\", \"backend\": \"%s\", ",
+                    first ? "" : ",", patterns[i], backends[j].name);
+            first = 0;
+            if (!ok) {
+                printf("\"error\": \"failed\"}");
+                continue;
+            }
+            printf("\"steps\": %llu, \"seconds\": %.6f, ", res.steps,
+                    res.seconds);
+            printf("\"steps_per_sec\": %.0f, \"ns_per_step\": %.3f, ",
+                    res.seconds > 0 ? res.steps / res.seconds : 0,
+                    res.steps > 0 ? res.seconds * 1e9 / res.steps : 0);
+            printf("\"peak_rss_kib\": %ld, ", peak_rss);
+            if (res.cache_misses >= 0) {
+                printf("\"cache_misses\": %lld, ", res.cache_misses);
+            } else {
+                printf("\"cache_misses\": null, ");
+            }
+            printf("\"ant\": [%d, %d]}", res.pos.y, res.pos.x);
+        }
+    }
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * channel.c
+ */
+
+#include <stdlib.h>
+
+#include "channel.h"
+
+void free_channel(channel *ch)
+{
+    /*
+     * Release the slots of a channel that neither thread uses any more.
+     *
+     * param ch - Channel to free
+     */
+    free(ch->slots);
+    ch->slots = NULL;
+}
+
+void *get_newest_slot(channel *ch)
+{
+    /*
+     * Return the most recently sent slot, giving back any older ones
+     * unread. It stays the consumer's until receive_slot.
+     *
+     * param ch - Channel to receive from
+     * return - Pointer to the slot, or NULL if nothing was sent
+     */
+    unsigned long head = atomic_load_explicit(&ch->head,
+            memory_order_acquire);
+    unsigned long tail = atomic_load_explicit(&ch->tail,
+            memory_order_relaxed);
+
+    if (head == tail) {
+        return NULL;
+    }
+    if (head - tail > 1) {
+        atomic_store_explicit(&ch->tail, head - 1, memory_order_release);
+    }
+    return ch->slots + ((head - 1) % ch->capacity) * ch->slot_size;
+}
+
+void *get_receive_slot(channel *ch)
+{
+    /*
+     * Return the oldest slot sent and not yet received. It stays the
+     * consumer's until receive_slot.
+     *
+     * param ch - Channel to receive from
+     * return - Pointer to the slot, or NULL if nothing is waiting
+     */
+    unsigned long head = atomic_load_explicit(&ch->head,
+            memory_order_acquire);
+    unsigned long tail = atomic_load_explicit(&ch->tail,
+            memory_order_relaxed);
+
+    if (head == tail) {
+        return NULL;
+    }
+    return ch->slots + (tail % ch->capacity) * ch->slot_size;
+}
+
+void *get_send_slot(channel *ch)
+{
+    /*
+     * Return the next free slot for the producer to fill.
+     *
+     * param ch - Channel to send on
+     * return - Pointer to the slot, or NULL if every slot is waiting to be
+     *   received
+     */
+    unsigned long head = atomic_load_explicit(&ch->head,
+            memory_order_relaxed);
+    unsigned long tail = atomic_load_explicit(&ch->tail,
+            memory_order_acquire);
+
+    if (head - tail == ch->capacity) {
+        return NULL;
+    }
+    return ch->slots + (head % ch->capacity) * ch->slot_size;
+}
+
+int init_channel(channel *ch, unsigned long capacity, size_t slot_size)
+{
+    /*
+     * Initialize an empty channel with zeroed slots.
+     *
+     * param ch - Channel to initialize
+     * param capacity - Number of slots
+     * param slot_size - Size of each slot in bytes
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    ch->slots = calloc(capacity, slot_size);
+    ch->slot_size = slot_size;
+    ch->capacity = capacity;
+    atomic_init(&ch->head, 0);
+    atomic_init(&ch->tail, 0);
+    return ch->slots != NULL ? 0 : -1;
+}
+
+void receive_slot(channel *ch)
+{
+    /*
+     * Give the slot returned by get_receive_slot or get_newest_slot back
+     * to the producer.
+     *
+     * param ch - Channel the slot came from
+     */
+    atomic_store_explicit(&ch->tail,
+            atomic_load_explicit(&ch->tail, memory_order_relaxed) + 1,
+            memory_order_release);
+}
+
+void send_slot(channel *ch)
+{
+    /*
+     * Hand the slot returned by get_send_slot to the consumer.
+     *
+     * param ch - Channel the slot belongs to
+     */
+    atomic_store_explicit(&ch->head,
+            atomic_load_explicit(&ch->head, memory_order_relaxed) + 1,
+            memory_order_release);
+}
@@ -0,0 +1,38 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+/*
+ * channel.h
+ *
+ * Lock-free ring of fixed-size slots passed from one producer thread to
+ * one consumer thread.
+ */
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * The producer fills the slot returned by get_send_slot and hands it over
+ * with send_slot; the consumer reads the slot returned by
+ * get_receive_slot (or get_newest_slot) and gives it back with
+ * receive_slot. Only the producer writes head and only the consumer
+ * writes tail, so neither ever waits for the other.
+ */
+typedef struct {
+    unsigned char *slots;
+    size_t slot_size;
+    unsigned long capacity;
+    // Slots sent and received so far
+    atomic_ulong head;
+    atomic_ulong tail;
+} channel;
+
+void free_channel(channel *ch);
+void *get_newest_slot(channel *ch);
+void *get_receive_slot(channel *ch);
+void *get_send_slot(channel *ch);
+int init_channel(channel *ch, unsigned long capacity, size_t slot_size);
+void receive_slot(channel *ch);
+void send_slot(channel *ch);
+
+#endif
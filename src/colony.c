@@ -0,0 +1,504 @@
+/*
+ * colony.c
+ *
+ * Ants step in generations: in every generation each ant takes one step,
+ * in order of its index. An ant only reads and writes the tile it stands
+ * on, so two ants can only affect each other within a generation when they
+ * start it on the same tile, and then the lower index goes first. Ants on
+ * the same tile are always in the same region, so workers can step their
+ * own regions independently and the result does not depend on the number
+ * of threads.
+ *
+ * Each worker keeps the chunks of its regions in a grid of its own. An ant
+ * that moves into another worker's region is put in that worker's outbox
+ * and picked up at the start of the next generation, after a barrier.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "colony.h"
+
+#define SPEC_DELIMITERS " \t\r\n,"
+
+static int push_index(index_list *l, int i)
+{
+    /*
+     * Append an ant index to a list.
+     *
+     * param l - List to append to
+     * param i - Index of the ant
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    if (l->count == l->capacity) {
+        int capacity = l->capacity ? l->capacity * 2 : 16;
+        int *items = realloc(l->items, capacity * sizeof(int));
+
+        if (items == NULL) {
+            return -1;
+        }
+        l->items = items;
+        l->capacity = capacity;
+    }
+    l->items[l->count++] = i;
+    return 0;
+}
+
+static int compare_index(const void *a, const void *b)
+{
+    /*
+     * qsort comparison function for ant indices.
+     */
+    return *(const int *) a - *(const int *) b;
+}
+
+static int region_owner(colony *c, point *p)
+{
+    /*
+     * Return the worker that owns the region containing a tile.
+     *
+     * param c - Colony whose workers own the regions
+     * param p - Pointer to the coordinates of the tile
+     * return - Index of the worker
+     */
+    unsigned int ry = (unsigned int) (p->y >> (CHUNK_SHIFT + REGION_SHIFT));
+    unsigned int rx = (unsigned int) (p->x >> (CHUNK_SHIFT + REGION_SHIFT));
+    unsigned int h = ry * 73856093u ^ rx * 19349663u;
+
+    return (h ^ (h >> 16)) % c->thread_count;
+}
+
+static int absorb_incoming(colony *c, colony_worker *w, int box)
+{
+    /*
+     * Move the ants that other workers handed to this worker into its
+     * owned list, keeping the list in index order.
+     *
+     * param c - Colony that holds the workers
+     * param w - Worker receiving the ants
+     * param box - Which of the double-buffered outboxes to read
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    index_list *in = &w->incoming;
+    int i, j, k;
+
+    in->count = 0;
+    for (int t = 0; t < c->thread_count; t++) {
+        index_list *from = &c->workers[t].outbox[box][w->id];
+        for (i = 0; i < from->count; i++) {
+            if (push_index(in, from->items[i]) != 0) {
+                return -1;
+            }
+        }
+        from->count = 0;
+    }
+    if (in->count == 0) {
+        return 0;
+    }
+    qsort(in->items, in->count, sizeof(int), compare_index);
+    // Merge from the back so the owned list can be extended in place
+    j = w->owned.count - 1;
+    k = in->count - 1;
+    for (i = 0; i < in->count; i++) {
+        if (push_index(&w->owned, 0) != 0) {
+            return -1;
+        }
+    }
+    for (i = w->owned.count - 1; k >= 0; i--) {
+        if (j >= 0 && w->owned.items[j] > in->items[k]) {
+            w->owned.items[i] = w->owned.items[j--];
+        } else {
+            w->owned.items[i] = in->items[k--];
+        }
+    }
+    return 0;
+}
+
+static int step_worker(colony *c, colony_worker *w, int box)
+{
+    /*
+     * Step every ant owned by a worker once, handing ants that leave its
+     * regions to their new owners.
+     *
+     * param c - Colony that holds the ants
+     * param w - Worker whose ants will be stepped
+     * param box - Which of the double-buffered outboxes to write
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    int kept = 0;
+
+    for (int i = 0; i < w->owned.count; i++) {
+        int idx = w->owned.items[i];
+        ant *a = &c->ants[idx];
+        int owner;
+
+        if (update_grid(&w->world, a, &c->rules[c->ant_rules[idx]]) != 0) {
+            return -1;
+        }
+        owner = region_owner(c, &a->pos);
+        if (owner == w->id) {
+            w->owned.items[kept++] = idx;
+        } else if (push_index(&w->outbox[box][owner], idx) != 0) {
+            return -1;
+        }
+    }
+    w->owned.count = kept;
+    return 0;
+}
+
+static void *run_worker(void *arg)
+{
+    /*
+     * Thread entry point: step the worker's ants for the requested number
+     * of generations, meeting the other workers at a barrier after each.
+     *
+     * param arg - Pointer to the colony_worker
+     * return - NULL
+     */
+    colony_worker *w = arg;
+    colony *c = w->c;
+
+    pthread_mutex_lock(&c->gate_lock);
+    while (c->gate_state == 0) {
+        pthread_cond_wait(&c->gate, &c->gate_lock);
+    }
+    pthread_mutex_unlock(&c->gate_lock);
+    if (c->gate_state < 0) {
+        return NULL;
+    }
+    for (unsigned long long g = 0; g < w->generations; g++) {
+        int box = (c->generation + g) & 1;
+        int failed;
+
+        if (absorb_incoming(c, w, box ^ 1) != 0 ||
+                step_worker(c, w, box) != 0) {
+            w->failed = 1;
+            atomic_store(&c->failed[box], 1);
+        }
+        pthread_barrier_wait(&c->barrier);
+        /*
+         * A worker failing in the next generation sets the other flag, so
+         * every worker reads the same value and all stop together
+         */
+        failed = atomic_load(&c->failed[box]);
+        if (failed) {
+            w->generations = g;
+            break;
+        }
+    }
+    return NULL;
+}
+
+int add_colony_ant(colony *c, point *pos, char dir, char *pattern)
+{
+    /*
+     * Add an ant to the colony. Must be called before start_colony.
+     *
+     * param c - Colony to add the ant to
+     * param pos - Pointer to the ant's starting position
+     * param dir - Ant's starting direction (L, U, R or D)
+     * param pattern - Valid pattern that determines the ant's behavior
+     * return - 0 on success, -1 if memory could not be allocated or there
+     *   are more than MAX_RULES different patterns
+     */
+    char upper[MAX_COLORS + 1];
+    int r;
+
+    for (r = 0; pattern[r] != '\0'; r++) {
+        upper[r] = toupper((unsigned char) pattern[r]);
+    }
+    upper[r] = '\0';
+    for (r = 0; r < c->rule_count; r++) {
+        if (strcmp(c->rules[r].pattern, upper) == 0) {
+            break;
+        }
+    }
+    if (r == c->rule_count) {
+        if (r == MAX_RULES) {
+            return -1;
+        }
+        compile_rule(&c->rules[c->rule_count++], upper);
+    }
+    if (c->ant_count == c->ant_capacity) {
+        int capacity = c->ant_capacity ? c->ant_capacity * 2 : 16;
+        ant *ants = realloc(c->ants, capacity * sizeof(ant));
+        int *ant_rules;
+
+        if (ants == NULL) {
+            return -1;
+        }
+        c->ants = ants;
+        ant_rules = realloc(c->ant_rules, capacity * sizeof(int));
+        if (ant_rules == NULL) {
+            return -1;
+        }
+        c->ant_rules = ant_rules;
+        c->ant_capacity = capacity;
+    }
+    c->ants[c->ant_count].pos = *pos;
+    set_ant_dir(&c->ants[c->ant_count], dir);
+    c->ant_rules[c->ant_count++] = r;
+    return 0;
+}
+
+void free_colony(colony *c)
+{
+    /*
+     * Release all memory and thread resources held by the colony.
+     *
+     * param c - Colony to free
+     */
+    for (int t = 0; c->workers != NULL && t < c->thread_count; t++) {
+        colony_worker *w = &c->workers[t];
+
+        free_grid(&w->world);
+        free(w->owned.items);
+        free(w->incoming.items);
+        for (int b = 0; b < 2; b++) {
+            for (int u = 0; u < c->thread_count; u++) {
+                free(w->outbox[b][u].items);
+            }
+            free(w->outbox[b]);
+        }
+    }
+    if (c->workers != NULL) {
+        pthread_barrier_destroy(&c->barrier);
+        pthread_mutex_destroy(&c->gate_lock);
+        pthread_cond_destroy(&c->gate);
+    }
+    free(c->workers);
+    free(c->ants);
+    free(c->ant_rules);
+    init_colony(c);
+}
+
+int get_colony_tile(colony *c, point *p)
+{
+    /*
+     * Return the value (color) of a tile. Must not be called while the
+     * colony is running.
+     *
+     * param c - Started colony that holds the tile
+     * param p - Pointer to the coordinates of the tile
+     * return - Value of the tile
+     */
+    return get_tile(&c->workers[region_owner(c, p)].world, p);
+}
+
+size_t colony_memory(colony *c)
+{
+    /*
+     * Return the number of bytes allocated for the grids of all workers.
+     *
+     * param c - Started colony to measure
+     * return - Total size of the workers' grids in bytes
+     */
+    size_t size = 0;
+
+    for (int t = 0; t < c->thread_count; t++) {
+        size += grid_memory(&c->workers[t].world);
+    }
+    return size;
+}
+
+void init_colony(colony *c)
+{
+    /*
+     * Initialize a colony with no ants.
+     *
+     * param c - Colony to initialize
+     */
+    memset(c, 0, sizeof(colony));
+}
+
+int load_scenario(colony *c, char *path, char dir, char *pattern)
+{
+    /*
+     * Add the ants listed in a scenario file to the colony. Each line
+     * holds one ant in the format accepted by parse_ant_spec. Blank lines
+     * and lines starting with '#' are ignored.
+     *
+     * param c - Colony to add the ants to
+     * param path - Path of the scenario file
+     * param dir - Direction of ants that do not give one
+     * param pattern - Pattern of ants that do not give one
+     * return - 0 on success, -1 if the file could not be read, or the
+     *   number of the first invalid line
+     */
+    FILE *f = fopen(path, "r");
+    char line[256];
+    int line_number = 0;
+
+    if (f == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *s = line;
+
+        line_number++;
+        while (isspace((unsigned char) *s)) {
+            s++;
+        }
+        if (*s == '\0' || *s == '#') {
+            continue;
+        }
+        if (parse_ant_spec(c, s, dir, pattern) != 0) {
+            fclose(f);
+            return line_number;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+int parse_ant_spec(colony *c, char *spec, char dir, char *pattern)
+{
+    /*
+     * Parse an ant given as "y,x[,direction[,pattern]]" (commas or
+     * whitespace) and add it to the colony.
+     *
+     * param c - Colony to add the ant to
+     * param spec - String describing the ant, modified while parsing
+     * param dir - Direction used if spec does not give one
+     * param pattern - Pattern used if spec does not give one
+     * return - 0 on success, -1 if spec is invalid
+     */
+    char *token[4] = {NULL};
+    char *end;
+    long v[2];
+    point pos;
+    int n = 0;
+
+    for (char *t = strtok(spec, SPEC_DELIMITERS); t != NULL;
+            t = strtok(NULL, SPEC_DELIMITERS)) {
+        if (n == 4) {
+            return -1;
+        }
+        token[n++] = t;
+    }
+    if (n < 2) {
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        v[i] = strtol(token[i], &end, 10);
+        if (*end != '\0' || v[i] < -(1L << 30) || v[i] > (1L << 30)) {
+            return -1;
+        }
+    }
+    set_point(&pos, v[0], v[1]);
+    if (token[2] != NULL) {
+        if (strlen(token[2]) != 1 || strchr("LlUuRrDd", token[2][0]) == NULL) {
+            return -1;
+        }
+        dir = token[2][0];
+    }
+    if (token[3] != NULL) {
+        if (!is_valid_pattern(token[3])) {
+            return -1;
+        }
+        pattern = token[3];
+    }
+    return add_colony_ant(c, &pos, dir, pattern);
+}
+
+int run_colony(colony *c, unsigned long long generations)
+{
+    /*
+     * Advance every ant of a started colony by a number of generations.
+     *
+     * param c - Colony to run
+     * param generations - Number of generations to run
+     * return - 0 on success, -1 if memory could not be allocated or a
+     *   thread could not be created; c->generation counts the generations
+     *   that completed
+     */
+    int t;
+
+    for (t = 0; t < c->thread_count; t++) {
+        c->workers[t].generations = generations;
+    }
+    atomic_store(&c->failed[0], 0);
+    atomic_store(&c->failed[1], 0);
+    c->gate_state = 0;
+    for (t = 1; t < c->thread_count; t++) {
+        if (pthread_create(&c->workers[t].thread, NULL, run_worker,
+                    &c->workers[t]) != 0) {
+            break;
+        }
+    }
+    // Open the gate, or close it for good if a thread is missing
+    pthread_mutex_lock(&c->gate_lock);
+    c->gate_state = t == c->thread_count ? 1 : -1;
+    pthread_cond_broadcast(&c->gate);
+    pthread_mutex_unlock(&c->gate_lock);
+    if (c->gate_state > 0) {
+        run_worker(&c->workers[0]);
+    }
+    while (--t > 0) {
+        pthread_join(c->workers[t].thread, NULL);
+    }
+    if (c->gate_state < 0) {
+        return -1;
+    }
+    c->generation += c->workers[0].generations;
+    // Pick up the ants that moved between regions in the last generation
+    for (t = 0; t < c->thread_count; t++) {
+        if (absorb_incoming(c, &c->workers[t], (c->generation - 1) & 1) != 0) {
+            c->workers[t].failed = 1;
+        }
+    }
+    for (t = 0; t < c->thread_count; t++) {
+        if (c->workers[t].failed) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int start_colony(colony *c, int thread_count)
+{
+    /*
+     * Create the workers of a colony and hand each ant to the worker that
+     * owns its starting tile.
+     *
+     * param c - Colony with at least one ant
+     * param thread_count - Number of worker threads, at least 1
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    int colors = 2;
+
+    c->workers = calloc(thread_count, sizeof(colony_worker));
+    if (c->workers == NULL) {
+        return -1;
+    }
+    c->thread_count = thread_count;
+    pthread_barrier_init(&c->barrier, NULL, thread_count);
+    pthread_mutex_init(&c->gate_lock, NULL);
+    pthread_cond_init(&c->gate, NULL);
+    for (int r = 0; r < c->rule_count; r++) {
+        colors = c->rules[r].colors > colors ? c->rules[r].colors : colors;
+    }
+    for (int t = 0; t < thread_count; t++) {
+        colony_worker *w = &c->workers[t];
+
+        w->c = c;
+        w->id = t;
+        init_grid(&w->world, choose_tile_bits(colors));
+        for (int b = 0; b < 2; b++) {
+            w->outbox[b] = calloc(thread_count, sizeof(index_list));
+            if (w->outbox[b] == NULL) {
+                return -1;
+            }
+        }
+    }
+    for (int i = 0; i < c->ant_count; i++) {
+        int owner = region_owner(c, &c->ants[i].pos);
+
+        if (push_index(&c->workers[owner].owned, i) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef COLONY_H
+#define COLONY_H
+
+/*
+ * colony.h
+ *
+ * Many ants on one grid, stepped in parallel by worker threads that each
+ * own a part of the world.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "ant.h"
+#include "grid.h"
+#include "point.h"
+#include "rule.h"
+
+/*
+ * The world is divided into square regions of 2^REGION_SHIFT chunks on a
+ * side, each owned by one worker thread.
+ */
+#define REGION_SHIFT 2
+#define MAX_RULES 64
+
+typedef struct {
+    int *items;
+    int count;
+    int capacity;
+} index_list;
+
+typedef struct colony_worker {
+    struct colony *c;
+    int id;
+    pthread_t thread;
+    // Tiles of the regions owned by this worker
+    grid world;
+    // Indices of the ants in those regions, in increasing order
+    index_list owned;
+    // Ants handed to each other worker, double-buffered by generation
+    index_list *outbox[2];
+    index_list incoming;
+    unsigned long long generations;
+    int failed;
+} colony_worker;
+
+typedef struct colony {
+    ant *ants;
+    int *ant_rules;
+    int ant_count;
+    int ant_capacity;
+    rule rules[MAX_RULES];
+    int rule_count;
+    int thread_count;
+    colony_worker *workers;
+    pthread_barrier_t barrier;
+    /*
+     * Set by any worker that fails in a generation, and read by all
+     * between its barrier and the next, double-buffered by generation
+     */
+    atomic_int failed[2];
+    // Workers wait at the gate until every thread has been created
+    pthread_mutex_t gate_lock;
+    pthread_cond_t gate;
+    int gate_state;
+    unsigned long long generation;
+} colony;
+
+int add_colony_ant(colony *c, point *pos, char dir, char *pattern);
+void free_colony(colony *c);
+int get_colony_tile(colony *c, point *p);
+size_t colony_memory(colony *c);
+void init_colony(colony *c);
+int load_scenario(colony *c, char *path, char dir, char *pattern);
+int parse_ant_spec(colony *c, char *spec, char dir, char *pattern);
+int run_colony(colony *c, unsigned long long generations);
+int start_colony(colony *c, int thread_count);
+
+#endif
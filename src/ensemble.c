@@ -0,0 +1,396 @@
+/*
+ * ensemble.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ant.h"
+#include "ensemble.h"
+
+static unsigned long long next_random(unsigned long long *state)
+{
+    /*
+     * Return the next number of a SplitMix64 sequence.
+     *
+     * param state - Pointer to the state of the sequence
+     * return - Pseudo-random 64-bit number
+     */
+    unsigned long long z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static int fill_grid(ensemble *e, grid *g, unsigned long long seed)
+{
+    /*
+     * Color the tiles of the square centered on the origin at random.
+     * The ant has not stood on them, so they are not marked visited.
+     *
+     * param e - Ensemble that gives the square's size and density
+     * param g - Blank grid to fill
+     * param seed - Seed of the run
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    int lo = -(e->size / 2);
+    int tracked = g->track_visited;
+    int status = 0;
+    point p;
+
+    // The visited bitmap keeps its place in the chunks while it is off
+    g->track_visited = 0;
+    for (p.y = lo; p.y < lo + e->size && status == 0; p.y++) {
+        for (p.x = lo; p.x < lo + e->size; p.x++) {
+            unsigned long long v = next_random(&seed);
+
+            if ((int) (v % 100) < e->density && change_tile(g, &p,
+                        1 + (v >> 32) % (e->r.colors - 1)) != 0) {
+                status = -1;
+                break;
+            }
+        }
+    }
+    g->track_visited = tracked;
+    return status;
+}
+
+static int escape_square(ensemble *e, grid *g, ant *a,
+        ensemble_result *res)
+{
+    /*
+     * Step the ant until it first leaves the random square. An ant d tiles
+     * inside every edge cannot leave within d steps, so it is advanced
+     * d + 1 steps at a time and checked only after each batch.
+     *
+     * param e - Ensemble that gives the square's size and the step limit
+     * param g - Grid the ant walks on
+     * param a - Pointer to the ant
+     * param res - Result of the run, whose step count and escape step are
+     *   updated
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    int lo = -(e->size / 2);
+    int hi = lo + e->size - 1;
+
+    while (res->steps < e->steps) {
+        unsigned long long n;
+        int d;
+
+        if (a->pos.y < lo || a->pos.y > hi || a->pos.x < lo ||
+                a->pos.x > hi) {
+            res->escape_step = res->steps;
+            break;
+        }
+        d = a->pos.y - lo;
+        d = hi - a->pos.y < d ? hi - a->pos.y : d;
+        d = a->pos.x - lo < d ? a->pos.x - lo : d;
+        d = hi - a->pos.x < d ? hi - a->pos.x : d;
+        n = e->steps - res->steps < (unsigned long long) d + 1 ?
+            e->steps - res->steps : (unsigned long long) d + 1;
+        if (step_grid(g, a, &e->r, &res->steps, n) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void run_member(ensemble *e, ensemble_worker *w, int index)
+{
+    /*
+     * Run the pattern once from its own random grid and record the result.
+     *
+     * param e - Ensemble the run belongs to
+     * param w - Worker running it
+     * param index - Index of the run
+     */
+    ensemble_result *res = &e->results[index];
+    unsigned long long state = e->seed + index;
+    ant a;
+
+    reset_grid(&w->world);
+    set_point(&a.pos, 0, 0);
+    set_ant_dir(&a, e->dir);
+    memset(res, 0, sizeof(ensemble_result));
+    res->seed = next_random(&state);
+    if (fill_grid(e, &w->world, res->seed) != 0 ||
+            escape_square(e, &w->world, &a, res) != 0) {
+        res->failed = 1;
+    } else if (res->steps < e->steps) {
+        // Look for a highway from where the ant left the square
+        init_highway(w->hw);
+        w->hw->next_check = res->steps + CHECK_INTERVAL;
+        plan_final_check(w->hw, res->steps, e->steps);
+        res->failed = advance_ant(&w->world, &a, &e->r, w->hw,
+                &res->steps, e->steps - res->steps) != 0;
+        if (w->hw->state == HIGHWAY_FOUND) {
+            res->highway_step = w->hw->base_step;
+            res->period = w->hw->period;
+        }
+    }
+    res->pos = a.pos;
+    res->visited = w->world.visited_count;
+}
+
+static void *run_ensemble_worker(void *arg)
+{
+    /*
+     * Thread entry point: take runs until there are none left.
+     *
+     * param arg - Pointer to the ensemble_worker
+     * return - NULL
+     */
+    ensemble_worker *w = arg;
+    ensemble *e = w->e;
+
+    for (;;) {
+        int index;
+
+        pthread_mutex_lock(&e->lock);
+        index = e->next_run < e->run_count ? e->next_run++ : -1;
+        pthread_mutex_unlock(&e->lock);
+        if (index < 0) {
+            return NULL;
+        }
+        run_member(e, w, index);
+    }
+}
+
+static int compare_steps(const void *p, const void *q)
+{
+    /*
+     * qsort comparison of two step counts.
+     *
+     * param p - Pointer to the first count
+     * param q - Pointer to the second count
+     * return - Negative, zero or positive as p is less than, equal to or
+     *   greater than q
+     */
+    unsigned long long a = *(const unsigned long long *) p;
+    unsigned long long b = *(const unsigned long long *) q;
+
+    return (a > b) - (a < b);
+}
+
+static void write_distribution(FILE *out, char *name,
+        unsigned long long *values, int n)
+{
+    /*
+     * Write a row of the summary table: the count, minimum, median, 90th
+     * percentile, maximum and mean of some values.
+     *
+     * param out - Stream to write to
+     * param name - Name of the row
+     * param values - Values, sorted in place
+     * param n - Number of values
+     */
+    double sum = 0;
+
+    if (n == 0) {
+        fprintf(out, "%-13s %6d\n", name, 0);
+        return;
+    }
+    qsort(values, n, sizeof(*values), compare_steps);
+    for (int i = 0; i < n; i++) {
+        sum += values[i];
+    }
+    fprintf(out, "%-13s %6d %10llu %10llu %10llu %10llu %12.1f\n", name, n,
+            values[0], values[n / 2], values[(n - 1) * 9 / 10],
+            values[n - 1], sum / n);
+}
+
+void free_ensemble(ensemble *e)
+{
+    /*
+     * Release the results of the ensemble.
+     *
+     * param e - Ensemble to free
+     */
+    free(e->results);
+    e->results = NULL;
+    e->run_count = 0;
+}
+
+void init_ensemble(ensemble *e, char *pattern, char dir)
+{
+    /*
+     * Initialize an ensemble of a pattern with the default square and
+     * seed.
+     *
+     * param e - Ensemble to initialize
+     * param pattern - Valid pattern to run
+     * param dir - Starting direction of the ant (L, U, R or D)
+     */
+    memset(e, 0, sizeof(ensemble));
+    compile_rule(&e->r, pattern);
+    e->dir = dir;
+    e->size = DEFAULT_FILL_SIZE;
+    e->density = DEFAULT_FILL_DENSITY;
+    e->seed = 1;
+}
+
+int parse_fill(ensemble *e, char *spec)
+{
+    /*
+     * Set the random square from a "<size>[:<density>]" string.
+     *
+     * param e - Ensemble to set
+     * param spec - Side of the square, 1 to MAX_FILL_SIZE tiles, and
+     *   optionally the percentage of tiles that are not black
+     * return - 0 on success, -1 if spec is invalid
+     */
+    char *end;
+    long size = strtol(spec, &end, 10);
+    long density = e->density;
+
+    if (end == spec || size < 1 || size > MAX_FILL_SIZE) {
+        return -1;
+    }
+    if (*end == ':') {
+        char *p = end + 1;
+
+        density = strtol(p, &end, 10);
+        if (end == p || density < 0 || density > 100) {
+            return -1;
+        }
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+    e->size = size;
+    e->density = density;
+    return 0;
+}
+
+int run_ensemble(ensemble *e, int runs, unsigned long long steps,
+        int threads)
+{
+    /*
+     * Run the pattern a number of times, each from its own random grid,
+     * on a pool of worker threads. Each worker reuses one grid for all of
+     * its runs.
+     *
+     * param e - Ensemble to run
+     * param runs - Number of runs, 1 to MAX_ENSEMBLE_RUNS
+     * param steps - Number of steps to run each time
+     * param threads - Number of worker threads, at least 1
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    int status = 0;
+    int t;
+
+    e->run_count = runs;
+    e->steps = steps;
+    e->next_run = 0;
+    e->thread_count = threads;
+    e->results = calloc(runs, sizeof(ensemble_result));
+    e->workers = calloc(threads, sizeof(ensemble_worker));
+    if (e->results == NULL || e->workers == NULL) {
+        free(e->workers);
+        e->workers = NULL;
+        return -1;
+    }
+    pthread_mutex_init(&e->lock, NULL);
+    for (t = 0; t < threads; t++) {
+        ensemble_worker *w = &e->workers[t];
+
+        w->e = e;
+        init_grid(&w->world, choose_tile_bits(e->r.colors));
+        track_visited(&w->world);
+        if ((w->hw = malloc(sizeof(highway))) == NULL) {
+            status = -1;
+        }
+    }
+    if (status == 0) {
+        for (t = 1; t < threads; t++) {
+            if (pthread_create(&e->workers[t].thread, NULL,
+                        run_ensemble_worker, &e->workers[t]) != 0) {
+                // The remaining runs are taken by the running workers
+                break;
+            }
+        }
+        run_ensemble_worker(&e->workers[0]);
+        while (--t > 0) {
+            pthread_join(e->workers[t].thread, NULL);
+        }
+    }
+    for (t = 0; t < threads; t++) {
+        free_grid(&e->workers[t].world);
+        free(e->workers[t].hw);
+    }
+    pthread_mutex_destroy(&e->lock);
+    free(e->workers);
+    e->workers = NULL;
+    return status;
+}
+
+void write_ensemble_csv(ensemble *e, FILE *out)
+{
+    /*
+     * Write the results of an ensemble as CSV, one row per run.
+     *
+     * param e - Ensemble that has been run
+     * param out - Stream to write to
+     */
+    fprintf(out, "run,seed,steps,escape_step,highway_step,highway_period,"
+            "visited,ant_y,ant_x,status\n");
+    for (int i = 0; i < e->run_count; i++) {
+        ensemble_result *r = &e->results[i];
+
+        fprintf(out, "%d,%llu,%llu,%llu,%llu,%d,%llu,%d,%d,%s\n", i,
+                r->seed, r->steps, r->escape_step, r->highway_step,
+                r->period, r->visited, r->pos.y, r->pos.x,
+                r->failed ? "out_of_memory" : "ok");
+    }
+}
+
+int write_ensemble_summary(ensemble *e, FILE *out)
+{
+    /*
+     * Write the distributions of the escape step, highway step and number
+     * of visited tiles over the runs that completed. Runs that never left
+     * the square or found no highway are left out of those rows.
+     *
+     * param e - Ensemble that has been run
+     * param out - Stream to write to
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    unsigned long long *values = malloc(e->run_count * sizeof(*values));
+    int n, failed = 0;
+
+    if (values == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < e->run_count; i++) {
+        failed += e->results[i].failed;
+    }
+    fprintf(out, "%-13s %6s %10s %10s %10s %10s %12s\n", "", "Runs", "Min",
+            "Median", "P90", "Max", "Mean");
+    n = 0;
+    for (int i = 0; i < e->run_count; i++) {
+        if (!e->results[i].failed && e->results[i].escape_step > 0) {
+            values[n++] = e->results[i].escape_step;
+        }
+    }
+    write_distribution(out, "Escape step", values, n);
+    n = 0;
+    for (int i = 0; i < e->run_count; i++) {
+        if (!e->results[i].failed && e->results[i].highway_step > 0) {
+            values[n++] = e->results[i].highway_step;
+        }
+    }
+    write_distribution(out, "Highway step", values, n);
+    n = 0;
+    for (int i = 0; i < e->run_count; i++) {
+        if (!e->results[i].failed) {
+            values[n++] = e->results[i].visited;
+        }
+    }
+    write_distribution(out, "Visited tiles", values, n);
+    if (failed > 0) {
+        fprintf(out, "Out of memory: %d runs\n", failed);
+    }
+    free(values);
+    return 0;
+}
@@ -0,0 +1,77 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+/*
+ * ensemble.h
+ *
+ * Run one pattern many times from random initial grids on a pool of
+ * worker threads, and gather the distribution of how the runs went.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "grid.h"
+#include "highway.h"
+#include "point.h"
+#include "rule.h"
+
+#define MAX_ENSEMBLE_RUNS (1 << 24)
+#define MAX_FILL_SIZE 4096
+#define DEFAULT_FILL_SIZE 32
+#define DEFAULT_FILL_DENSITY 50
+
+typedef struct {
+    // Seed of the run's initial grid
+    unsigned long long seed;
+    unsigned long long steps;
+    // First step the ant stood outside the random square, 0 if never
+    unsigned long long escape_step;
+    // Step at which a highway was confirmed, 0 if none
+    unsigned long long highway_step;
+    int period;
+    point pos;
+    unsigned long long visited;
+    int failed;
+} ensemble_result;
+
+typedef struct {
+    struct ensemble *e;
+    pthread_t thread;
+    // Grid and highway state reused between runs
+    grid world;
+    highway *hw;
+} ensemble_worker;
+
+/*
+ * Before each run, the tiles of a size x size square centered on the ant
+ * are colored at random: each is black with probability 100 - density
+ * percent, otherwise one of the other colors of the pattern. Run i uses
+ * the seed derived from seed and i, so results do not depend on the
+ * number of threads.
+ */
+typedef struct ensemble {
+    rule r;
+    char dir;
+    int size;
+    int density;
+    unsigned long long seed;
+    unsigned long long steps;
+    int run_count;
+    ensemble_result *results;
+    // Index of the next run to hand out
+    int next_run;
+    pthread_mutex_t lock;
+    int thread_count;
+    ensemble_worker *workers;
+} ensemble;
+
+void free_ensemble(ensemble *e);
+void init_ensemble(ensemble *e, char *pattern, char dir);
+int parse_fill(ensemble *e, char *spec);
+int run_ensemble(ensemble *e, int runs, unsigned long long steps,
+        int threads);
+void write_ensemble_csv(ensemble *e, FILE *out);
+int write_ensemble_summary(ensemble *e, FILE *out);
+
+#endif
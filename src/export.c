@@ -0,0 +1,366 @@
+/*
+ * export.c
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "export.h"
+
+// Largest block of an uncompressed (stored) deflate stream
+#define STORED_BLOCK_MAX 65535
+// Bytes that can be summed before the Adler-32 sums must be reduced
+#define ADLER_RUN 5552
+// Scanline bytes gathered into each IDAT chunk
+#define IDAT_SIZE (1 << 18)
+
+/*
+ * RGB color of each tile value. The first eight follow enum tile_color as
+ * the terminal draws them, the rest are their bright variants.
+ */
+static const unsigned char palette[MAX_COLORS][3] = {
+    {0, 0, 0}, {229, 229, 229}, {0, 0, 238}, {0, 205, 0},
+    {205, 0, 205}, {205, 205, 0}, {0, 205, 205}, {205, 0, 0},
+    {127, 127, 127}, {255, 255, 255}, {92, 92, 255}, {0, 255, 0},
+    {255, 0, 255}, {255, 255, 0}, {0, 255, 255}, {255, 0, 0}
+};
+
+typedef struct {
+    FILE *f;
+    uint32_t crc;
+    uint32_t adler_a, adler_b;
+} png_writer;
+
+static uint32_t crc_table[256];
+
+static void init_crc_table(void)
+{
+    /*
+     * Fill the lookup table of the CRC-32 used by PNG chunks.
+     */
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static void put_u32(unsigned char *buf, uint32_t v)
+{
+    /*
+     * Store a 32-bit value in big-endian (network) byte order.
+     *
+     * param buf - Four bytes to write to
+     * param v - Value to store
+     */
+    buf[0] = v >> 24;
+    buf[1] = v >> 16;
+    buf[2] = v >> 8;
+    buf[3] = v;
+}
+
+static void png_bytes(png_writer *w, unsigned char *data, size_t len)
+{
+    /*
+     * Write the bytes of a chunk's type or data, updating its CRC.
+     *
+     * param w - Writer of the PNG file
+     * param data - Bytes to write
+     * param len - Number of bytes
+     */
+    for (size_t i = 0; i < len; i++) {
+        w->crc = crc_table[(w->crc ^ data[i]) & 0xff] ^ (w->crc >> 8);
+    }
+    fwrite(data, 1, len, w->f);
+}
+
+static void png_begin(png_writer *w, char *type, uint32_t len)
+{
+    /*
+     * Start a PNG chunk. Exactly len bytes of data must follow.
+     *
+     * param w - Writer of the PNG file
+     * param type - Four-letter chunk type
+     * param len - Length of the chunk's data
+     */
+    unsigned char buf[4];
+
+    put_u32(buf, len);
+    fwrite(buf, 1, 4, w->f);
+    w->crc = 0xffffffffu;
+    png_bytes(w, (unsigned char *) type, 4);
+}
+
+static void png_end(png_writer *w)
+{
+    /*
+     * Finish a PNG chunk by writing its CRC.
+     *
+     * param w - Writer of the PNG file
+     */
+    unsigned char buf[4];
+
+    put_u32(buf, w->crc ^ 0xffffffffu);
+    fwrite(buf, 1, 4, w->f);
+}
+
+static void png_image_data(png_writer *w, unsigned char *data, size_t len,
+        int last)
+{
+    /*
+     * Write part of the image data as one IDAT chunk of stored deflate
+     * blocks, updating the Adler-32 checksum of the zlib stream.
+     *
+     * param w - Writer of the PNG file
+     * param data - Filtered scanline bytes
+     * param len - Number of bytes
+     * param last - 1 (true) if these are the final bytes of the image
+     */
+    size_t blocks = (len + STORED_BLOCK_MAX - 1) / STORED_BLOCK_MAX;
+    unsigned char buf[5];
+
+    // Reduce the sums only as often as they could overflow 32 bits
+    for (size_t i = 0; i < len; i += ADLER_RUN) {
+        size_t end = i + ADLER_RUN < len ? i + ADLER_RUN : len;
+
+        for (size_t j = i; j < end; j++) {
+            w->adler_a += data[j];
+            w->adler_b += w->adler_a;
+        }
+        w->adler_a %= 65521;
+        w->adler_b %= 65521;
+    }
+    png_begin(w, "IDAT", len + blocks * 5 + (last ? 4 : 0));
+    for (size_t i = 0; i < blocks; i++) {
+        size_t n = len - i * STORED_BLOCK_MAX;
+
+        n = n > STORED_BLOCK_MAX ? STORED_BLOCK_MAX : n;
+        buf[0] = last && i == blocks - 1;
+        buf[1] = n & 0xff;
+        buf[2] = n >> 8;
+        buf[3] = ~n & 0xff;
+        buf[4] = (~n >> 8) & 0xff;
+        png_bytes(w, buf, 5);
+        png_bytes(w, data + i * STORED_BLOCK_MAX, n);
+    }
+    if (last) {
+        put_u32(buf, (w->adler_b << 16) | w->adler_a);
+        png_bytes(w, buf, 4);
+    }
+    png_end(w);
+}
+
+static void read_row(grid *g, int y, int x0, int width, unsigned char *row)
+{
+    /*
+     * Read one row of tiles from the grid.
+     *
+     * param g - Grid to read
+     * param y - Row of the tiles
+     * param x0 - Column of the first tile
+     * param width - Number of tiles to read
+     * param row - Buffer receiving one tile value per byte
+     */
+    point p = {y, x0};
+
+    for (int i = 0; i < width; i++, p.x++) {
+        row[i] = get_tile(g, &p);
+    }
+}
+
+static int write_png(FILE *f, grid *g, point *min, int height, int width)
+{
+    /*
+     * Write the tiles in a rectangle of the grid as a 4-bit indexed PNG.
+     * The image is streamed in stored (uncompressed) deflate blocks,
+     * gathering as many scanlines as fit in IDAT_SIZE bytes, and at least
+     * one, into each IDAT chunk.
+     *
+     * param f - File to write to
+     * param g - Grid to export
+     * param min - Top-left tile of the rectangle
+     * param height - Rows of tiles in the rectangle
+     * param width - Columns of tiles in the rectangle
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    static const unsigned char signature[8] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+    };
+    size_t line = 1 + ((size_t) width + 1) / 2;
+    size_t capacity = line < IDAT_SIZE ? IDAT_SIZE - IDAT_SIZE % line : line;
+    size_t used = 0;
+    unsigned char *row = malloc(width);
+    unsigned char *lines = malloc(capacity);
+    unsigned char header[13];
+    unsigned char zlib_header[2] = {0x78, 0x01};
+    png_writer w = {f, 0, 1, 0};
+
+    if (row == NULL || lines == NULL) {
+        free(row);
+        free(lines);
+        return -1;
+    }
+    if (crc_table[1] == 0) {
+        init_crc_table();
+    }
+    fwrite(signature, 1, sizeof(signature), f);
+
+    // 4-bit palette image, default compression, filtering and interlace
+    put_u32(header, width);
+    put_u32(header + 4, height);
+    header[8] = 4;
+    header[9] = 3;
+    header[10] = header[11] = header[12] = 0;
+    png_begin(&w, "IHDR", sizeof(header));
+    png_bytes(&w, header, sizeof(header));
+    png_end(&w);
+    png_begin(&w, "PLTE", sizeof(palette));
+    png_bytes(&w, (unsigned char *) palette, sizeof(palette));
+    png_end(&w);
+
+    // The zlib header goes in its own IDAT, outside the Adler-32 sum
+    png_begin(&w, "IDAT", sizeof(zlib_header));
+    png_bytes(&w, zlib_header, sizeof(zlib_header));
+    png_end(&w);
+    for (int y = 0; y < height; y++) {
+        unsigned char *scanline = lines + used;
+
+        read_row(g, min->y + y, min->x, width, row);
+        // Filter type 0 (none), then two tiles per byte
+        memset(scanline, 0, line);
+        for (int x = 0; x < width; x++) {
+            scanline[1 + x / 2] |= row[x] << (x & 1 ? 0 : 4);
+        }
+        used += line;
+        if (used == capacity || y == height - 1) {
+            png_image_data(&w, lines, used, y == height - 1);
+            used = 0;
+        }
+    }
+    png_begin(&w, "IEND", 0);
+    png_end(&w);
+    free(row);
+    free(lines);
+    return 0;
+}
+
+static int write_ppm(FILE *f, grid *g, point *min, int height, int width)
+{
+    /*
+     * Write the tiles in a rectangle of the grid as a binary PPM, one row
+     * at a time.
+     *
+     * param f - File to write to
+     * param g - Grid to export
+     * param min - Top-left tile of the rectangle
+     * param height - Rows of tiles in the rectangle
+     * param width - Columns of tiles in the rectangle
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    unsigned char *row = malloc(width);
+    unsigned char *pixels = malloc((size_t) width * 3);
+
+    if (row == NULL || pixels == NULL) {
+        free(row);
+        free(pixels);
+        return -1;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    for (int y = 0; y < height; y++) {
+        read_row(g, min->y + y, min->x, width, row);
+        for (int x = 0; x < width; x++) {
+            memcpy(pixels + x * 3, palette[row[x]], 3);
+        }
+        fwrite(pixels, 3, width, f);
+    }
+    free(row);
+    free(pixels);
+    return 0;
+}
+
+int export_image(char *path, grid *g, point *top_left,
+        point *bottom_right)
+{
+    /*
+     * Write a rectangle of the grid to an image file, one pixel per tile.
+     * Files ending in ".png" are written as PNG, anything else as binary
+     * PPM.
+     *
+     * param path - Path of the image file
+     * param g - Grid to export
+     * param top_left - Pointer to the top-left tile of the rectangle, or
+     *   NULL for the smallest rectangle that holds every non-black tile
+     * param bottom_right - Pointer to the bottom-right tile of the
+     *   rectangle, or NULL along with top_left
+     * return - 0 on success, -1 if the file could not be written or the
+     *   world is too large for one image
+     */
+    size_t len = strlen(path);
+    long long height = 1, width = 1;
+    point min = {0, 0}, max;
+    int status;
+    FILE *f;
+
+    if (top_left != NULL) {
+        min = *top_left;
+        height = (long long) bottom_right->y - min.y + 1;
+        width = (long long) bottom_right->x - min.x + 1;
+    } else if (get_bounds(g, &min, &max) == 0) {
+        // An all-black grid is written as a single black pixel
+        height = (long long) max.y - min.y + 1;
+        width = (long long) max.x - min.x + 1;
+    }
+    if (height < 1 || width < 1 || height > INT32_MAX ||
+            width > INT32_MAX) {
+        return -1;
+    }
+    if ((f = fopen(path, "wb")) == NULL) {
+        return -1;
+    }
+    if (len >= 4 && path[len - 4] == '.' &&
+            tolower((unsigned char) path[len - 3]) == 'p' &&
+            tolower((unsigned char) path[len - 2]) == 'n' &&
+            tolower((unsigned char) path[len - 1]) == 'g') {
+        status = write_png(f, g, &min, height, width);
+    } else {
+        status = write_ppm(f, g, &min, height, width);
+    }
+    if (ferror(f)) {
+        status = -1;
+    }
+    if (fclose(f) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+int format_frame_path(char *buf, size_t size, char *path,
+        unsigned long long frame)
+{
+    /*
+     * Build the path of one time-lapse frame by inserting the frame number
+     * before the extension, so "out.png" becomes "out-000042.png".
+     *
+     * param buf - Buffer receiving the path
+     * param size - Size of buf
+     * param path - Image path given by the user
+     * param frame - Frame number
+     * return - 0 on success, -1 if the path does not fit in buf
+     */
+    char *slash = strrchr(path, '/');
+    char *dot = strrchr(path, '.');
+    int stem, n;
+
+    if (dot == NULL || (slash != NULL && dot < slash) || dot == path) {
+        dot = path + strlen(path);
+    }
+    stem = dot - path;
+    n = snprintf(buf, size, "%.*s-%06llu%s", stem, path, frame, dot);
+    return n < 0 || (size_t) n >= size ? -1 : 0;
+}
@@ -0,0 +1,22 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+/*
+ * export.h
+ *
+ * Image export of the grid as PPM or PNG, one pixel per tile.
+ */
+
+#include <stddef.h>
+
+#include "grid.h"
+#include "point.h"
+
+#define DEFAULT_IMAGE "langtons_ant.png"
+
+int export_image(char *path, grid *g, point *top_left,
+        point *bottom_right);
+int format_frame_path(char *buf, size_t size, char *path,
+        unsigned long long frame);
+
+#endif
@@ -2,92 +2,1130 @@
  * grid.c
  */
 
-#include <ncurses.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "grid.h"
+#include "kernel.h"
+#include "stats.h"
 
-void change_tile(int grid[][GRID_SIZE_X], point *p, int pattern_len)
+#define INITIAL_BUCKETS 64
+
+#define TILE_INDEX(p) CHUNK_INDEX((p)->y & CHUNK_MASK, (p)->x & CHUNK_MASK)
+
+/*
+ * With 1-bit tiles every 64 tiles of a chunk are one 64-bit word: a row in
+ * the row-major layout, an 8x8 square in the Morton one. Tile i of a word
+ * is bit i & 7 of byte i >> 3, which is bit i of the word on little-endian
+ * machines and bit i ^ 56 on big-endian ones.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define WORD_BIT(x) ((x) ^ 56)
+#else
+#define WORD_BIT(x) (x)
+#endif
+
+static unsigned int hash_chunk(int cy, int cx, unsigned int bucket_count)
+{
+    /*
+     * Return the hash bucket of the chunk with the given chunk coordinates.
+     *
+     * param cy - Chunk row
+     * param cx - Chunk column
+     * param bucket_count - Number of buckets (a power of two)
+     * return - Index into the bucket array
+     */
+    unsigned int h = (unsigned int) cy * 73856093u ^
+        (unsigned int) cx * 19349663u;
+
+    h ^= h >> 16;
+    return h & (bucket_count - 1);
+}
+
+static void set_chunk_stride(grid *g)
+{
+    /*
+     * Work out where the optional per-chunk data lives and the size of a
+     * chunk in the pool.
+     *
+     * param g - Grid whose tile size and tracking options are set
+     */
+    size_t size = TILES_PER_CHUNK * g->tile_bits / 8;
+
+    if (g->track_visited) {
+        g->visited_offset = size;
+        size += TILES_PER_CHUNK / 8;
+    }
+    if (g->track_summary) {
+        g->summary_colors = (g->tile_mask < MAX_COLORS ?
+                (int) g->tile_mask + 1 : MAX_COLORS) - 1;
+        // The group pointers come first, then the chunk's own counts
+        g->summary_offset = (size + sizeof(void *) - 1) &
+            ~(sizeof(void *) - 1);
+        size = g->summary_offset + SUMMARY_LEVELS * sizeof(void *) +
+            g->summary_colors * (sizeof(unsigned short) + SUMMARY_BLOCKS);
+    }
+    // Keep every chunk in a block pointer-aligned
+    g->chunk_stride = (sizeof(chunk) + size + sizeof(void *) - 1) &
+        ~(sizeof(void *) - 1);
+}
+
+static int get_tile_value(grid *g, chunk *c, unsigned int i)
+{
+    /*
+     * Return the value of a tile within a chunk.
+     *
+     * param g - Grid that holds the chunk
+     * param c - Chunk that holds the tile
+     * param i - Index of the tile within the chunk
+     * return - Value (color) of the tile
+     */
+    return (c->tiles[i >> g->tile_shift] >>
+            ((i & ((1u << g->tile_shift) - 1)) * g->tile_bits)) &
+        g->tile_mask;
+}
+
+static summary_group **get_chunk_groups(grid *g, chunk *c)
+{
+    /*
+     * Return the pointers to the groups that hold a chunk.
+     *
+     * param g - Grid that keeps color counts
+     * param c - Chunk of the grid
+     * return - Array of SUMMARY_LEVELS pointers, from level 1 up
+     */
+    return (summary_group **) &c->tiles[g->summary_offset];
+}
+
+static unsigned short *get_chunk_counts(grid *g, chunk *c)
+{
+    /*
+     * Return the color counts of a whole chunk, which are followed by
+     * those of its squares.
+     *
+     * param g - Grid that keeps color counts
+     * param c - Chunk of the grid
+     * return - Array of summary_colors counts
+     */
+    return (unsigned short *) (get_chunk_groups(g, c) + SUMMARY_LEVELS);
+}
+
+static void update_summary(grid *g, chunk *c, int y, int x, int old,
+        int value)
+{
+    /*
+     * Move one tile from the counts of its old color to those of its new
+     * color.
+     *
+     * param g - Grid that keeps color counts
+     * param c - Chunk that holds the tile
+     * param y - Row of the tile within the chunk
+     * param x - Column of the tile within the chunk
+     * param old - Previous value of the tile
+     * param value - New value of the tile
+     */
+    summary_group **groups = get_chunk_groups(g, c);
+    unsigned short *counts = get_chunk_counts(g, c);
+    unsigned char *block = (unsigned char *) (counts + g->summary_colors) +
+        (((y >> SUMMARY_SHIFT) << (CHUNK_SHIFT - SUMMARY_SHIFT)) +
+         (x >> SUMMARY_SHIFT)) * g->summary_colors;
+
+    // Black is not counted, it is whatever the other colors leave
+    if (old > 0 && old <= g->summary_colors) {
+        counts[old - 1]--;
+        block[old - 1]--;
+        for (int l = 0; l < SUMMARY_LEVELS; l++) {
+            groups[l]->counts[old - 1]--;
+        }
+    }
+    if (value > 0 && value <= g->summary_colors) {
+        counts[value - 1]++;
+        block[value - 1]++;
+        for (int l = 0; l < SUMMARY_LEVELS; l++) {
+            groups[l]->counts[value - 1]++;
+        }
+    }
+}
+
+static chunk *find_chunk(grid *g, int cy, int cx)
+{
+    /*
+     * Return the chunk with the given chunk coordinates, or NULL if it has
+     * not been allocated.
+     *
+     * param g - Grid to search
+     * param cy - Chunk row
+     * param cx - Chunk column
+     * return - Pointer to the chunk or NULL
+     */
+    chunk *c = g->last;
+
+    STAT_ADD(chunk_lookups, 1);
+    if (c != NULL && c->origin.y == cy && c->origin.x == cx) {
+        STAT_ADD(chunk_cache_hits, 1);
+        return c;
+    }
+    if (g->buckets == NULL) {
+        return NULL;
+    }
+    for (c = g->buckets[hash_chunk(cy, cx, g->bucket_count)]; c != NULL;
+            c = c->next) {
+        if (c->origin.y == cy && c->origin.x == cx) {
+            g->last = c;
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static int grow_buckets(grid *g)
+{
+    /*
+     * Double the number of hash buckets and rehash all chunks.
+     *
+     * param g - Grid whose hash table will grow
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    unsigned int new_count = g->bucket_count ? g->bucket_count * 2 :
+        INITIAL_BUCKETS;
+    chunk **new_buckets = calloc(new_count, sizeof(chunk *));
+
+    if (new_buckets == NULL) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < g->bucket_count; i++) {
+        chunk *c = g->buckets[i];
+        while (c != NULL) {
+            chunk *next = c->next;
+            unsigned int h = hash_chunk(c->origin.y, c->origin.x, new_count);
+            c->next = new_buckets[h];
+            new_buckets[h] = c;
+            c = next;
+        }
+    }
+    free(g->buckets);
+    g->buckets = new_buckets;
+    g->bucket_count = new_count;
+    return 0;
+}
+
+static unsigned int hash_group(int level, int gy, int gx,
+        unsigned int bucket_count)
+{
+    /*
+     * Return the hash bucket of a summary group.
+     *
+     * param level - Level of the group
+     * param gy - Row of the group, in groups
+     * param gx - Column of the group, in groups
+     * param bucket_count - Number of buckets (a power of two)
+     * return - Index into the bucket array
+     */
+    return (hash_chunk(gy, gx, bucket_count) + level) & (bucket_count - 1);
+}
+
+static summary_group *find_group(grid *g, int level, int gy, int gx)
+{
+    /*
+     * Return a summary group, or NULL if no chunk inside it has been
+     * allocated.
+     *
+     * param g - Grid that keeps color counts
+     * param level - Level of the group, 1 to SUMMARY_LEVELS
+     * param gy - Row of the group, in groups
+     * param gx - Column of the group, in groups
+     * return - Pointer to the group or NULL
+     */
+    if (g->groups == NULL) {
+        return NULL;
+    }
+    for (summary_group *s = g->groups[hash_group(level, gy, gx,
+                g->group_bucket_count)]; s != NULL; s = s->next) {
+        if (s->level == level && s->origin.y == gy && s->origin.x == gx) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static int grow_groups(grid *g)
 {
     /*
-     * Increment the value (color) of a tile on the grid.
+     * Double the number of summary group buckets and rehash all groups.
      *
-     * param grid - The 2D grid array that holds the tile
+     * param g - Grid whose group table will grow
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    unsigned int new_count = g->group_bucket_count ?
+        g->group_bucket_count * 2 : INITIAL_BUCKETS;
+    summary_group **new_buckets = calloc(new_count, sizeof(summary_group *));
+
+    if (new_buckets == NULL) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < g->group_bucket_count; i++) {
+        summary_group *s = g->groups[i];
+        while (s != NULL) {
+            summary_group *next = s->next;
+            unsigned int h = hash_group(s->level, s->origin.y, s->origin.x,
+                    new_count);
+            s->next = new_buckets[h];
+            new_buckets[h] = s;
+            s = next;
+        }
+    }
+    free(g->groups);
+    g->groups = new_buckets;
+    g->group_bucket_count = new_count;
+    return 0;
+}
+
+static summary_group *get_group(grid *g, int level, int gy, int gx)
+{
+    /*
+     * Return a summary group, allocating it with all counts at 0 if it
+     * does not exist yet.
+     *
+     * param g - Grid that keeps color counts
+     * param level - Level of the group, 1 to SUMMARY_LEVELS
+     * param gy - Row of the group, in groups
+     * param gx - Column of the group, in groups
+     * return - Pointer to the group or NULL if memory could not be
+     *   allocated
+     */
+    summary_group *s = find_group(g, level, gy, gx);
+    unsigned int h;
+
+    if (s != NULL) {
+        return s;
+    }
+    if (g->group_count >= g->group_bucket_count && grow_groups(g) != 0) {
+        return NULL;
+    }
+    s = calloc(1, sizeof(summary_group) +
+            g->summary_colors * sizeof(unsigned int));
+    if (s == NULL) {
+        return NULL;
+    }
+    set_point(&s->origin, gy, gx);
+    s->level = level;
+    h = hash_group(level, gy, gx, g->group_bucket_count);
+    s->next = g->groups[h];
+    g->groups[h] = s;
+    g->group_count++;
+    return s;
+}
+
+static void free_groups(grid *g)
+{
+    /*
+     * Release every summary group and the group table.
+     *
+     * param g - Grid that keeps color counts
+     */
+    for (unsigned int i = 0; i < g->group_bucket_count; i++) {
+        summary_group *s = g->groups[i];
+        while (s != NULL) {
+            summary_group *next = s->next;
+            free(s);
+            s = next;
+        }
+    }
+    free(g->groups);
+    g->groups = NULL;
+    g->group_bucket_count = 0;
+    g->group_count = 0;
+}
+
+static chunk *alloc_chunk(grid *g)
+{
+    /*
+     * Take a zeroed chunk from the grid's pool, allocating a new block of
+     * chunks if the pool is exhausted.
+     *
+     * param g - Grid that owns the pool
+     * return - Pointer to the chunk or NULL if memory could not be allocated
+     */
+    chunk *c;
+
+    if (g->free_block == NULL || g->free_index == CHUNKS_PER_BLOCK) {
+        if (g->free_block != NULL && g->free_block->next != NULL) {
+            // Reuse a block kept from before the last reset
+            g->free_block = g->free_block->next;
+        } else {
+            chunk_block *b = malloc(sizeof(chunk_block) +
+                    CHUNKS_PER_BLOCK * g->chunk_stride);
+            if (b == NULL) {
+                return NULL;
+            }
+            b->next = NULL;
+            if (g->free_block == NULL) {
+                g->blocks = b;
+            } else {
+                g->free_block->next = b;
+            }
+            g->free_block = b;
+        }
+        g->free_index = 0;
+    }
+    c = (chunk *) &g->free_block->data[g->free_index++ * g->chunk_stride];
+    memset(c->tiles, 0, g->chunk_stride - sizeof(chunk));
+    return c;
+}
+
+chunk *get_chunk(grid *g, int cy, int cx)
+{
+    /*
+     * Return the chunk with the given chunk coordinates, allocating it if
+     * it does not exist yet.
+     *
+     * param g - Grid that holds the chunk
+     * param cy - Chunk row
+     * param cx - Chunk column
+     * return - Pointer to the chunk or NULL if memory could not be allocated
+     */
+    chunk *c = find_chunk(g, cy, cx);
+    summary_group *groups[SUMMARY_LEVELS];
+    unsigned int h;
+
+    if (c != NULL) {
+        return c;
+    }
+    if (g->chunk_count >= g->bucket_count && grow_buckets(g) != 0) {
+        return NULL;
+    }
+    for (int l = 0; g->track_summary && l < SUMMARY_LEVELS; l++) {
+        if ((groups[l] = get_group(g, l + 1, cy >> (l + 1),
+                        cx >> (l + 1))) == NULL) {
+            return NULL;
+        }
+    }
+    if ((c = alloc_chunk(g)) == NULL) {
+        return NULL;
+    }
+    set_point(&c->origin, cy, cx);
+    if (g->track_summary) {
+        memcpy(get_chunk_groups(g, c), groups, sizeof(groups));
+    }
+    // Track the bounding box of allocated chunks
+    if (g->chunk_count == 0) {
+        g->chunk_min = c->origin;
+        g->chunk_max = c->origin;
+    } else {
+        g->chunk_min.y = cy < g->chunk_min.y ? cy : g->chunk_min.y;
+        g->chunk_min.x = cx < g->chunk_min.x ? cx : g->chunk_min.x;
+        g->chunk_max.y = cy > g->chunk_max.y ? cy : g->chunk_max.y;
+        g->chunk_max.x = cx > g->chunk_max.x ? cx : g->chunk_max.x;
+    }
+    STAT_ADD(chunks_allocated, 1);
+    h = hash_chunk(cy, cx, g->bucket_count);
+    c->next = g->buckets[h];
+    g->buckets[h] = c;
+    g->chunk_count++;
+    g->last = c;
+    return c;
+}
+
+static void mark_visited(grid *g, chunk *c, unsigned int i, point *p)
+{
+    /*
+     * Record that the ant stood on a tile.
+     *
+     * param g - Grid that tracks visited tiles
+     * param c - Chunk that holds the tile
+     * param i - Index of the tile within the chunk
+     * param p - Pointer to the coordinates of the tile
+     */
+    unsigned char *v = &c->tiles[g->visited_offset + (i >> 3)];
+
+    if (*v & (1 << (i & 7))) {
+        return;
+    }
+    *v |= 1 << (i & 7);
+    add_visited(g, p);
+}
+
+static unsigned char *get_tile_byte(grid *g, point *p, int *shift)
+{
+    /*
+     * Return a pointer to the byte that holds a tile, allocating its chunk
+     * if it does not exist yet.
+     *
+     * param g - Grid that holds the tile
+     * param p - Pointer to the coordinates of the tile
+     * param shift - Pointer to the bit position of the tile in the byte
+     * return - Pointer to the byte or NULL if memory could not be allocated
+     */
+    chunk *c = get_chunk(g, p->y >> CHUNK_SHIFT, p->x >> CHUNK_SHIFT);
+    unsigned int i = TILE_INDEX(p);
+
+    if (c == NULL) {
+        return NULL;
+    }
+    if (g->track_visited) {
+        mark_visited(g, c, i, p);
+    }
+    *shift = (i & ((1u << g->tile_shift) - 1)) * g->tile_bits;
+    return &c->tiles[i >> g->tile_shift];
+}
+
+void add_visited(grid *g, point *p)
+{
+    /*
+     * Count a tile the ant stands on for the first time, whose bit in the
+     * visited bitmap the caller has just set.
+     *
+     * param g - Grid that tracks visited tiles
+     * param p - Pointer to the coordinates of the tile
+     */
+    if (g->visited_count++ == 0) {
+        g->visited_min = *p;
+        g->visited_max = *p;
+        return;
+    }
+    g->visited_min.y = p->y < g->visited_min.y ? p->y : g->visited_min.y;
+    g->visited_min.x = p->x < g->visited_min.x ? p->x : g->visited_min.x;
+    g->visited_max.y = p->y > g->visited_max.y ? p->y : g->visited_max.y;
+    g->visited_max.x = p->x > g->visited_max.x ? p->x : g->visited_max.x;
+}
+
+int change_tile(grid *g, point *p, int value)
+{
+    /*
+     * Set the value (color) of a tile on the grid.
+     *
+     * param g - Grid that holds the tile
      * param p - Pointer to the coordinates of the tile on the grid
-     * param pattern_len - Length of the pattern that describes ant behavior
-     *   Determines maximum value of tiles
+     * param value - New value of the tile
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    int shift;
+    unsigned char *byte = get_tile_byte(g, p, &shift);
+
+    if (byte == NULL) {
+        return -1;
+    }
+    if (g->track_summary) {
+        // get_tile_byte leaves the tile's chunk in g->last
+        update_summary(g, g->last, p->y & CHUNK_MASK, p->x & CHUNK_MASK,
+                (*byte >> shift) & g->tile_mask, value);
+    }
+    *byte = (*byte & ~(g->tile_mask << shift)) | (value << shift);
+    return 0;
+}
+
+int choose_tile_bits(int colors)
+{
+    /*
+     * Return the smallest supported number of bits per tile that can hold
+     * the given number of colors.
+     *
+     * param colors - Number of colors used by the pattern
+     * return - 1, 4 or 8
+     */
+    if (colors <= 2) {
+        return 1;
+    } else if (colors <= 16) {
+        return 4;
+    }
+    return 8;
+}
+
+void clear_dirty(dirty_list *d)
+{
+    /*
+     * Empty the dirty list after a frame has been drawn.
+     *
+     * param d - Dirty list to clear
+     */
+    d->count = 0;
+    d->full_redraw = 0;
+}
+
+void free_dirty(dirty_list *d)
+{
+    /*
+     * Release the memory held by a dirty list.
+     *
+     * param d - Dirty list to free
+     */
+    free(d->cells);
+    d->cells = NULL;
+    d->capacity = 0;
+    d->count = 0;
+}
+
+void free_grid(grid *g)
+{
+    /*
+     * Release all memory held by the grid and leave it empty.
+     *
+     * param g - Grid to free
+     */
+    chunk_block *b = g->blocks;
+    int tile_bits = g->tile_bits;
+    int tracked = g->track_visited;
+    int summary = g->track_summary;
+
+    while (b != NULL) {
+        chunk_block *next = b->next;
+        free(b);
+        b = next;
+    }
+    free(g->buckets);
+    free_groups(g);
+    init_grid(g, tile_bits);
+    if (tracked) {
+        track_visited(g);
+    }
+    g->track_summary = summary;
+    set_chunk_stride(g);
+}
+
+int get_block_color(grid *g, point *b, int zoom)
+{
+    /*
+     * Return the most common color in a square block of tiles, as shown
+     * by zoomed-out views. Blocks of at least SUMMARY_SIZE tiles on a side
+     * are read from the grid's color counts if it keeps them, adding up at
+     * most the squares of one chunk or a single group up to a zoom of
+     * CHUNK_SHIFT + SUMMARY_LEVELS.
+     *
+     * param g - Grid that holds the tiles
+     * param b - Pointer to the coordinates of the block, in blocks
+     * param zoom - log2 of the number of tiles on a side of the block
+     * return - Value of the most common tile in the block
+     */
+    unsigned long long counts[MAX_COLORS] = {0};
+    unsigned long long total = 1ULL << (2 * zoom);
+    int size = 1 << zoom;
+    int best = 0;
+
+    if (zoom == 0) {
+        return get_tile(g, b);
+    }
+    if (zoom < SUMMARY_SHIFT || !g->track_summary) {
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                point p = {b->y * size + y, b->x * size + x};
+                counts[get_tile(g, &p)]++;
+            }
+        }
+        counts[0] = 0;
+    } else if (zoom < CHUNK_SHIFT) {
+        // Add up the summary squares of one chunk
+        point p = {b->y * size, b->x * size};
+        chunk *c = find_chunk(g, p.y >> CHUNK_SHIFT, p.x >> CHUNK_SHIFT);
+        int n = size >> SUMMARY_SHIFT;
+        int y0 = (p.y & CHUNK_MASK) >> SUMMARY_SHIFT;
+        int x0 = (p.x & CHUNK_MASK) >> SUMMARY_SHIFT;
+        unsigned char *blocks;
+
+        if (c == NULL) {
+            return 0;
+        }
+        blocks = (unsigned char *) (get_chunk_counts(g, c) +
+                g->summary_colors);
+        for (int y = y0; y < y0 + n; y++) {
+            for (int x = x0; x < x0 + n; x++) {
+                unsigned char *block = blocks +
+                    ((y << (CHUNK_SHIFT - SUMMARY_SHIFT)) + x) *
+                    g->summary_colors;
+
+                for (int k = 0; k < g->summary_colors; k++) {
+                    counts[k + 1] += block[k];
+                }
+            }
+        }
+    } else if (zoom == CHUNK_SHIFT) {
+        // Read the counts of one whole chunk
+        chunk *c = find_chunk(g, b->y, b->x);
+        unsigned short *chunk_counts;
+
+        if (c == NULL) {
+            return 0;
+        }
+        chunk_counts = get_chunk_counts(g, c);
+        for (int k = 0; k < g->summary_colors; k++) {
+            counts[k + 1] += chunk_counts[k];
+        }
+    } else {
+        // Add up the groups that make up the block, one up to the top level
+        int level = zoom - CHUNK_SHIFT < SUMMARY_LEVELS ?
+            zoom - CHUNK_SHIFT : SUMMARY_LEVELS;
+        int n = 1 << (zoom - CHUNK_SHIFT - level);
+
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                summary_group *s = find_group(g, level, b->y * n + y,
+                        b->x * n + x);
+
+                if (s == NULL) {
+                    continue;
+                }
+                for (int k = 0; k < g->summary_colors; k++) {
+                    counts[k + 1] += s->counts[k];
+                }
+            }
+        }
+    }
+    // Black is whatever the other colors leave
+    counts[0] = total;
+    for (int k = 1; k < MAX_COLORS; k++) {
+        counts[0] -= counts[k];
+    }
+    for (int k = 1; k < MAX_COLORS; k++) {
+        best = counts[k] > counts[best] ? k : best;
+    }
+    return best;
+}
+
+static int row_extent(grid *g, chunk *c, int y, int *first, int *last)
+{
+    /*
+     * Find the first and last tiles of a chunk row that are not black.
+     *
+     * param g - Grid that holds the chunk
+     * param c - Chunk to search
+     * param y - Row within the chunk
+     * param first - Pointer to the column of the first non-black tile
+     * param last - Pointer to the column of the last non-black tile
+     * return - 0 on success, -1 if the whole row is black
      */
-    grid[p->y][p->x] = (grid[p->y][p->x] + 1) % pattern_len;
+#ifdef MORTON_TILES
+    // The tiles of a row are spread over the chunk, so read them one by one
+    *first = -1;
+    for (int x = 0; x < CHUNK_SIZE; x++) {
+        if (get_tile_value(g, c, CHUNK_INDEX(y, x)) != 0) {
+            *last = x;
+            *first = *first < 0 ? x : *first;
+        }
+    }
+    return *first < 0 ? -1 : 0;
+#else
+    size_t row_bytes = CHUNK_SIZE * g->tile_bits / 8;
+    unsigned char *bytes = &c->tiles[y * row_bytes];
+
+    *first = -1;
+    for (size_t b = 0; b < row_bytes; b++) {
+        if (bytes[b] != 0) {
+            *last = b;
+            *first = *first < 0 ? (int) b : *first;
+        }
+    }
+    if (*first < 0) {
+        return -1;
+    }
+    // Narrow the first and last bytes down to their tiles
+    *first <<= g->tile_shift;
+    while (get_tile_value(g, c, CHUNK_INDEX(y, *first)) == 0) {
+        (*first)++;
+    }
+    *last = ((*last + 1) << g->tile_shift) - 1;
+    while (get_tile_value(g, c, CHUNK_INDEX(y, *last)) == 0) {
+        (*last)--;
+    }
+    return 0;
+#endif
 }
 
-void init_grid(int grid[][GRID_SIZE_X])
+int get_bounds(grid *g, point *min, point *max)
 {
     /*
-     * Initialize all tiles on grid with a value of 0 (color Black).
+     * Find the smallest rectangle that holds every tile that is not black.
+     * Only chunks that reach outside the rectangle found so far are
+     * scanned.
      *
-     * param grid - Grid to be initialized
+     * param g - Grid to search
+     * param min - Pointer to the top-left tile of the rectangle
+     * param max - Pointer to the bottom-right tile of the rectangle
+     * return - 0 on success, -1 if every tile is black
      */
-    for (int i = 0; i < GRID_SIZE_Y; i++) {
-        for (int j = 0; j < GRID_SIZE_X; j++) {
-            grid[i][j] = 0;
+    int found = 0;
+
+    for (unsigned int i = 0; g->buckets != NULL && i < g->bucket_count;
+            i++) {
+        for (chunk *c = g->buckets[i]; c != NULL; c = c->next) {
+            point o = {c->origin.y * CHUNK_SIZE,
+                c->origin.x * CHUNK_SIZE};
+
+            if (found && o.y >= min->y && o.y + CHUNK_MASK <= max->y &&
+                    o.x >= min->x && o.x + CHUNK_MASK <= max->x) {
+                continue;
+            }
+            for (int y = 0; y < CHUNK_SIZE; y++) {
+                int first, last;
+
+                if (row_extent(g, c, y, &first, &last) != 0) {
+                    continue;
+                }
+                if (!found) {
+                    set_point(min, o.y + y, o.x + first);
+                    set_point(max, o.y + y, o.x + last);
+                    found = 1;
+                    continue;
+                }
+                min->y = o.y + y < min->y ? o.y + y : min->y;
+                min->x = o.x + first < min->x ? o.x + first : min->x;
+                max->y = o.y + y > max->y ? o.y + y : max->y;
+                max->x = o.x + last > max->x ? o.x + last : max->x;
+            }
         }
     }
+    return found ? 0 : -1;
 }
 
-void render_grid(int grid[][GRID_SIZE_X], int row, int col,
-        point *grid_offset)
+point get_grid_origin(int row, int col, point *grid_offset)
 {
     /*
-     * Draw the grid on the terminal.
+     * Return the terminal coordinates at which tile (0, 0) is drawn.
      *
-     * param grid - Grid to render
      * param row - Number of rows (lines) in the terminal
      * param col - Number of columns in the terminal
      * param grid_offset - Pointer to the grid offset
+     * return - Screen position of the grid origin, always on an even column
      */
-    point start_p = {(row - GRID_SIZE_Y) / 2, (col - GRID_SIZE_X * 2) / 2};
-
-    start_p = add_points(&start_p, grid_offset);
-    // Make sure we start on an even column
-    if (start_p.x % 2 != 0) {
-        start_p.x += 1;
-    }
-    for (int i = 0; i < GRID_SIZE_Y; i++) {
-        for (int j = 0; j < GRID_SIZE_X; j++) {
-            char s[3] = "  ";
-            /*
-             * ncurses has only 8 bg colors, so use characters to indicate
-             * colors 8 - 15
-             */
-            if (grid[i][j] > 7) {
-                strcpy(s, "##");
+    point origin = {row / 2, (col / 2) & ~1};
+
+    return add_points(&origin, grid_offset);
+}
+
+int get_tile(grid *g, point *p)
+{
+    /*
+     * Return the value (color) of a tile on the grid.
+     *
+     * param g - Grid that holds the tile
+     * param p - Pointer to the coordinates of the tile
+     * return - Value of the tile, 0 (black) if it was never changed
+     */
+    chunk *c = find_chunk(g, p->y >> CHUNK_SHIFT, p->x >> CHUNK_SHIFT);
+    unsigned int i = TILE_INDEX(p);
+
+    if (c == NULL) {
+        return 0;
+    }
+    return get_tile_value(g, c, i);
+}
+
+size_t grid_memory(grid *g)
+{
+    /*
+     * Return the number of bytes allocated by the grid.
+     *
+     * param g - Grid to measure
+     * return - Size of the chunk pool, summary groups and hash tables in
+     *   bytes
+     */
+    size_t size = g->bucket_count * sizeof(chunk *) +
+        g->group_bucket_count * sizeof(summary_group *) +
+        g->group_count * (sizeof(summary_group) +
+                g->summary_colors * sizeof(unsigned int));
+
+    for (chunk_block *b = g->blocks; b != NULL; b = b->next) {
+        size += sizeof(chunk_block) + CHUNKS_PER_BLOCK * g->chunk_stride;
+    }
+    return size;
+}
+
+int init_dirty(dirty_list *d, int capacity)
+{
+    /*
+     * Allocate an empty dirty list. The first frame is always a full
+     * redraw.
+     *
+     * param d - Dirty list to initialize
+     * param capacity - Maximum number of tiles tracked between frames
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    d->cells = malloc(capacity * sizeof(point));
+    d->capacity = d->cells != NULL ? capacity : 0;
+    d->count = 0;
+    d->full_redraw = 1;
+    return d->cells != NULL ? 0 : -1;
+}
+
+void init_grid(grid *g, int tile_bits)
+{
+    /*
+     * Initialize an empty grid. All tiles read as 0 (color Black) and no
+     * memory is allocated until a tile is changed.
+     *
+     * param g - Grid to be initialized
+     * param tile_bits - Bits of storage per tile (1, 4 or 8)
+     *   Must be enough to hold every color of the pattern
+     */
+    memset(g, 0, sizeof(grid));
+    g->tile_bits = tile_bits;
+    // log2 of the number of tiles per byte
+    g->tile_shift = tile_bits == 1 ? 3 : tile_bits == 4 ? 1 : 0;
+    g->tile_mask = (1u << tile_bits) - 1;
+    set_chunk_stride(g);
+}
+
+void mark_dirty(dirty_list *d, point *p)
+{
+    /*
+     * Record that a tile changed and must be redrawn in the next frame.
+     *
+     * param d - Dirty list to add the tile to
+     * param p - Pointer to the coordinates of the changed tile
+     */
+    if (d->full_redraw) {
+        return;
+    }
+    if (d->count == d->capacity) {
+        d->full_redraw = 1;
+        return;
+    }
+    d->cells[d->count++] = *p;
+}
+
+void reset_grid(grid *g)
+{
+    /*
+     * Set all tiles back to 0 (color Black). Chunk memory is kept in the
+     * pool and reused as the ant revisits the world.
+     *
+     * param g - Grid to be reset
+     */
+    if (g->buckets != NULL) {
+        memset(g->buckets, 0, g->bucket_count * sizeof(chunk *));
+    }
+    free_groups(g);
+    g->chunk_count = 0;
+    g->free_block = g->blocks;
+    g->free_index = 0;
+    g->last = NULL;
+    g->visited_count = 0;
+    set_point(&g->visited_min, 0, 0);
+    set_point(&g->visited_max, 0, 0);
+}
+
+static int step_two_color(grid *g, ant *a, rule *r,
+        unsigned long long *steps)
+{
+    /*
+     * Advance an ant with a two-color pattern on a grid of 1-bit tiles.
+     * While the ant stays inside a chunk it works on the chunk's tiles as
+     * 64-bit words: each step flips one bit and looks up the turn and move
+     * for the bit's old value, with no chunk lookup and no branches.
+     *
+     * param g - Grid of 1-bit tiles to be updated
+     * param a - Pointer to the ant
+     * param r - Pointer to the compiled two-color rule
+     * param steps - Pointer to the number of steps to advance, counted
+     *   down as they are taken
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    transition table[2][4];
+    int summary = g->track_summary;
+    unsigned long long left = *steps;
+
+    // A local copy of the table cannot alias the tiles being written
+    memcpy(table, r->table, sizeof(table));
+    while (left > 0) {
+        int cy = a->pos.y >> CHUNK_SHIFT;
+        int cx = a->pos.x >> CHUNK_SHIFT;
+        chunk *c = get_chunk(g, cy, cx);
+        int y = a->pos.y & CHUNK_MASK;
+        int x = a->pos.x & CHUNK_MASK;
+        int dir = a->dir;
+
+        if (c == NULL) {
+            *steps = left;
+            return -1;
+        }
+        // Step until the ant walks off the edge of the chunk
+        while (left > 0 && (unsigned int) (y | x) < CHUNK_SIZE) {
+            unsigned int i = CHUNK_INDEX(y, x);
+            unsigned char *bytes = &c->tiles[(i >> 6) * sizeof(uint64_t)];
+            uint64_t word;
+            int value;
+            transition *t;
+
+            memcpy(&word, bytes, sizeof(word));
+            value = (word >> WORD_BIT(i & 63)) & 1;
+            word ^= (uint64_t) 1 << WORD_BIT(i & 63);
+            memcpy(bytes, &word, sizeof(word));
+            if (summary) {
+                update_summary(g, c, y, x, value, !value);
             }
-            // Render tile
-            attron(COLOR_PAIR(grid[i][j] % 8));
-            mvprintw(start_p.y + i, start_p.x + j * 2, "%s", s);
-            attroff(COLOR_PAIR(grid[i][j]));
+            t = &table[value][dir];
+            dir = t->dir;
+            y += t->dy;
+            x += t->dx;
+            left--;
         }
+        a->dir = dir;
+        a->pos.y = cy * CHUNK_SIZE + y;
+        a->pos.x = cx * CHUNK_SIZE + x;
     }
+    *steps = 0;
+    return 0;
 }
 
-void update_grid(int grid[][GRID_SIZE_X], ant *a, char *pattern)
+int step_grid(grid *g, ant *a, rule *r, unsigned long long *step_count,
+        unsigned long long steps)
+{
+    /*
+     * Advance the ant a number of steps, like calling update_grid that many
+     * times. Patterns with a kernel of their own use it, other two-color
+     * patterns on 1-bit tiles take the bitboard path and the rest run the
+     * kernel loop on their compiled table.
+     *
+     * param g - Grid to be updated
+     * param a - Pointer to the ant
+     * param r - Pointer to the compiled rule that describes ant behavior
+     * param step_count - Pointer to the ant's step count, advanced by the
+     *   number of steps taken
+     * param steps - Number of steps to advance
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    unsigned long long left = steps;
+    step_kernel kernel;
+    int status = 0;
+
+    if (!g->track_visited && !g->track_summary &&
+            (kernel = find_kernel(r->pattern, g->tile_bits)) != NULL) {
+        status = kernel(g, a, &left);
+    } else if (r->colors == 2 && g->tile_bits == 1 && !g->track_visited) {
+        status = step_two_color(g, a, r, &left);
+    } else if (!g->track_summary) {
+        status = step_table(g, a, r, &left);
+    } else {
+        for (; left > 0; left--) {
+            if (update_grid(g, a, r) != 0) {
+                status = -1;
+                break;
+            }
+        }
+    }
+    *step_count += steps - left;
+    return status;
+}
+
+int track_summary(grid *g)
+{
+    /*
+     * Make the grid keep the color counts read by zoomed-out views. Tiles
+     * already on the grid are moved into chunks with room for the counts.
+     *
+     * param g - Grid to keep color counts for
+     * return - 0 on success, -1 if memory could not be allocated, in which
+     *   case the grid is left unchanged
+     */
+    grid old = *g;
+    size_t size = old.chunk_stride - sizeof(chunk);
+
+    if (g->track_summary) {
+        return 0;
+    }
+    init_grid(g, old.tile_bits);
+    g->track_visited = old.track_visited;
+    g->track_summary = 1;
+    set_chunk_stride(g);
+    for (unsigned int i = 0; old.buckets != NULL && i < old.bucket_count;
+            i++) {
+        for (chunk *c = old.buckets[i]; c != NULL; c = c->next) {
+            chunk *copy = get_chunk(g, c->origin.y, c->origin.x);
+
+            if (copy == NULL) {
+                free_grid(g);
+                *g = old;
+                return -1;
+            }
+            // Tiles and visited bitmap keep their place in the chunk
+            memcpy(copy->tiles, c->tiles, size);
+            for (int y = 0; y < CHUNK_SIZE; y++) {
+                for (int x = 0; x < CHUNK_SIZE; x++) {
+                    update_summary(g, copy, y, x, 0,
+                            get_tile_value(g, copy, CHUNK_INDEX(y, x)));
+                }
+            }
+        }
+    }
+    g->visited_count = old.visited_count;
+    g->visited_min = old.visited_min;
+    g->visited_max = old.visited_max;
+    free_grid(&old);
+    return 0;
+}
+
+void track_visited(grid *g)
+{
+    /*
+     * Make the grid count the distinct tiles the ant stands on and their
+     * bounding box. Must be called before any tile is changed.
+     *
+     * param g - Empty grid to track visited tiles on
+     */
+    g->track_visited = 1;
+    set_chunk_stride(g);
+}
+
+int unstep_grid(grid *g, ant *a, rule *r)
+{
+    /*
+     * Undo the last update_grid call. The ant steps back onto the tile it
+     * came from, restores the tile's previous color and turns back, so
+     * any number of steps can be reversed without keeping a history.
+     *
+     * param g - Grid to be updated
+     * param a - Pointer to ant
+     * param r - Pointer to the compiled rule that describes ant behavior
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    // The move back depends only on the direction, so any row will do
+    transition *t = &r->inverse[0][a->dir];
+    point from = {a->pos.y + t->dy, a->pos.x + t->dx};
+    int shift;
+    unsigned char *byte = get_tile_byte(g, &from, &shift);
+
+    if (byte == NULL) {
+        return -1;
+    }
+    t = &r->inverse[(*byte >> shift) & g->tile_mask][a->dir];
+    if (g->track_summary) {
+        update_summary(g, g->last, from.y & CHUNK_MASK,
+                from.x & CHUNK_MASK, (*byte >> shift) & g->tile_mask,
+                t->next);
+    }
+    *byte = (*byte & ~(g->tile_mask << shift)) | (t->next << shift);
+    a->dir = t->dir;
+    a->pos = from;
+    return 0;
+}
+
+int update_grid(grid *g, ant *a, rule *r)
 {
     /* Update grid based on ant's position and direction.
      *
-     * param grid - Grid to be updated
+     * param g - Grid to be updated
      * param a - Pointer to ant
-     * param pattern - String that describes ant behavior
+     * param r - Pointer to the compiled rule that describes ant behavior
+     * return - 0 on success, -1 if memory could not be allocated
      */
-    point prev_pos, pos;
-    prev_pos = a->pos;
+    int shift;
+    unsigned char *byte = get_tile_byte(g, &a->pos, &shift);
+    transition *t;
 
-    // Update ant direction
-    rotate_ant(a, grid[a->pos.y][a->pos.x], pattern);
-    // Update ant position
-    pos = add_points(&a->pos, &a->dir);
-    set_point(&a->pos, pos.y, pos.x);
-    // Change color of tile at previous position
-    change_tile(grid, &prev_pos, strlen(pattern));
+    if (byte == NULL) {
+        return -1;
+    }
+    t = &r->table[(*byte >> shift) & g->tile_mask][a->dir];
+    if (g->track_summary) {
+        update_summary(g, g->last, a->pos.y & CHUNK_MASK,
+                a->pos.x & CHUNK_MASK, (*byte >> shift) & g->tile_mask,
+                t->next);
+    }
+    // Change color of tile, then turn and move the ant
+    *byte = (*byte & ~(g->tile_mask << shift)) | (t->next << shift);
+    a->dir = t->dir;
+    a->pos.y += t->dy;
+    a->pos.x += t->dx;
+    return 0;
 }
 
 void update_offset(point *grid_offset, enum offset_direction dir)
@@ -119,3 +1157,27 @@ void update_offset(point *grid_offset, enum offset_direction dir)
             break;
     }
 }
+
+void zoom_offset(point *grid_offset, int from, int to)
+{
+    /*
+     * Change the grid offset for a new zoom level so that the tile in the
+     * middle of the terminal stays there.
+     *
+     * param grid_offset - Grid offset to update
+     * param from - Current zoom level
+     * param to - New zoom level
+     */
+    // Block shown in the middle of the terminal
+    long long y = -grid_offset->y;
+    long long x = -grid_offset->x / 2;
+
+    if (to < from) {
+        y *= 1LL << (from - to);
+        x *= 1LL << (from - to);
+    } else {
+        y >>= to - from;
+        x >>= to - from;
+    }
+    set_point(grid_offset, -y, -x * 2);
+}
@@ -5,12 +5,60 @@
  * grid.h
  */
 
+#include <stddef.h>
+
 #include "ant.h"
 #include "point.h"
+#include "rule.h"
+
+/*
+ * The grid is unbounded and sparse. Tiles are stored in square chunks of
+ * CHUNK_SIZE x CHUNK_SIZE that are only allocated once the ant changes a
+ * tile inside them. Unallocated chunks read as all black.
+ */
+#define CHUNK_SHIFT 6
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+#define TILES_PER_CHUNK (CHUNK_SIZE * CHUNK_SIZE)
+#define CHUNKS_PER_BLOCK 64
 
-#define GRID_SIZE_Y 201
-#define GRID_SIZE_X 201
-#define MAX_COLORS 16
+/*
+ * Index of tile (y, x) within its chunk, for 0 <= y, x < CHUNK_SIZE.
+ * Chunks are row-major by default. Building with MORTON_TILES
+ * ("make MORTON=1") interleaves the bits of y and x instead (Z-order), so
+ * every aligned square of tiles is contiguous and a vertical step rarely
+ * leaves the cache line the ant is on.
+ */
+#ifdef MORTON_TILES
+#define TILE_LAYOUT_MORTON 1
+#define CHUNK_INDEX(y, x) ((morton_spread(y) << 1) | morton_spread(x))
+
+static inline unsigned int morton_spread(unsigned int v)
+{
+    /*
+     * Spread the six (CHUNK_SHIFT) low bits of v out to every other bit.
+     */
+    v = (v | (v << 4)) & 0x30f;
+    v = (v | (v << 2)) & 0x333;
+    return (v | (v << 1)) & 0x555;
+}
+#else
+#define TILE_LAYOUT_MORTON 0
+#define CHUNK_INDEX(y, x) ((y) * CHUNK_SIZE + (x))
+#endif
+
+/*
+ * Zoomed-out views read color counts kept for every chunk, for each
+ * square of 2^SUMMARY_SHIFT tiles on a side within it and for each square
+ * of 2^level chunks on a side, for level 1 to SUMMARY_LEVELS, instead of
+ * the tiles themselves. A block of any zoom up to
+ * CHUNK_SHIFT + SUMMARY_LEVELS then adds up a bounded number of counts.
+ */
+#define SUMMARY_SHIFT 3
+#define SUMMARY_SIZE (1 << SUMMARY_SHIFT)
+#define SUMMARY_BLOCKS ((CHUNK_SIZE / SUMMARY_SIZE) * \
+        (CHUNK_SIZE / SUMMARY_SIZE))
+#define SUMMARY_LEVELS 4
 
 enum offset_direction {
     LEFT,
@@ -31,11 +79,99 @@ enum tile_color {
     RED
 };
 
-void change_tile(int grid[][GRID_SIZE_X], point *p, int pattern_len);
-void init_grid(int grid[][GRID_SIZE_X]);
-void render_grid(int grid[][GRID_SIZE_X], int row, int col,
-        point *grid_offset);
-void update_grid(int grid[][GRID_SIZE_X], ant *a, char *pattern);
+/*
+ * Tiles are packed tile_bits to a byte-aligned field, in CHUNK_INDEX
+ * order: 1 bit for two-color patterns, 4 bits for up to MAX_COLORS.
+ * 8 bits (one byte per tile) trades memory for fewer shifts.
+ */
+typedef struct chunk {
+    point origin;
+    struct chunk *next;
+    unsigned char tiles[];
+} chunk;
+
+/*
+ * Color counts of a square of 2^level chunks on a side, whose origin is
+ * in units of that square
+ */
+typedef struct summary_group {
+    point origin;
+    int level;
+    struct summary_group *next;
+    unsigned int counts[];
+} summary_group;
+
+typedef struct chunk_block {
+    struct chunk_block *next;
+    unsigned char data[];
+} chunk_block;
+
+/*
+ * Tiles changed since the last frame. If more tiles change than the list
+ * can hold, the next frame falls back to a full redraw.
+ */
+typedef struct {
+    point *cells;
+    int count;
+    int capacity;
+    int full_redraw;
+} dirty_list;
+
+typedef struct {
+    chunk **buckets;
+    unsigned int bucket_count;
+    unsigned int chunk_count;
+    int tile_bits;
+    int tile_shift;
+    unsigned int tile_mask;
+    size_t chunk_stride;
+    // Optional bitmap of tiles the ant has stood on, after the tiles
+    int track_visited;
+    size_t visited_offset;
+    unsigned long long visited_count;
+    point visited_min, visited_max;
+    /*
+     * Optional counts of the summary_colors colors after black, after the
+     * visited bitmap: pointers to the SUMMARY_LEVELS groups that hold the
+     * chunk, one unsigned short per color for the whole chunk, then one
+     * byte per color for each of its SUMMARY_BLOCKS squares
+     */
+    int track_summary;
+    int summary_colors;
+    size_t summary_offset;
+    summary_group **groups;
+    unsigned int group_bucket_count;
+    unsigned int group_count;
+    point chunk_min, chunk_max;
+    chunk_block *blocks;
+    chunk_block *free_block;
+    unsigned int free_index;
+    chunk *last;
+} grid;
+
+void add_visited(grid *g, point *p);
+int change_tile(grid *g, point *p, int value);
+int choose_tile_bits(int colors);
+void clear_dirty(dirty_list *d);
+void free_dirty(dirty_list *d);
+void free_grid(grid *g);
+chunk *get_chunk(grid *g, int cy, int cx);
+int get_block_color(grid *g, point *b, int zoom);
+int get_bounds(grid *g, point *min, point *max);
+point get_grid_origin(int row, int col, point *grid_offset);
+int get_tile(grid *g, point *p);
+size_t grid_memory(grid *g);
+int init_dirty(dirty_list *d, int capacity);
+void init_grid(grid *g, int tile_bits);
+void mark_dirty(dirty_list *d, point *p);
+void reset_grid(grid *g);
+int step_grid(grid *g, ant *a, rule *r, unsigned long long *step_count,
+        unsigned long long steps);
+int track_summary(grid *g);
+void track_visited(grid *g);
+int unstep_grid(grid *g, ant *a, rule *r);
+int update_grid(grid *g, ant *a, rule *r);
 void update_offset(point *grid_offset, enum offset_direction dir);
+void zoom_offset(point *grid_offset, int from, int to);
 
 #endif
@@ -0,0 +1,605 @@
+/*
+ * hashlife.c
+ *
+ * The ant only ever changes the tile it stands on, so its walk through a
+ * node depends only on the node's contents and the state in which the ant
+ * entered it. Each node is hash-consed and every walk that ends with the
+ * ant leaving the node is memoized. A walk through a node of level k is
+ * computed by walking through its four level k - 1 children, so repeated
+ * structure anywhere in the world is only ever simulated once.
+ *
+ * Walks are bounded by a step budget so that a run can stop on an exact
+ * step count: a memoized walk is only reused when it fits in the budget,
+ * otherwise the node is walked child by child.
+ *
+ * Garbage collection copies the nodes still reachable from the root into
+ * fresh blocks, hash-consing them again, and drops every memoized walk.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashlife.h"
+
+#define INITIAL_BUCKETS 1024
+
+typedef struct {
+    hl_node *node;
+    int y, x, dir;
+    unsigned long long steps;
+} hl_walk;
+
+static void *hl_alloc(hl_world *w, size_t size)
+{
+    /*
+     * Allocate memory that lives as long as the world.
+     *
+     * param w - World that owns the memory
+     * param size - Number of bytes to allocate
+     * return - Pointer to the memory or NULL if it could not be allocated
+     */
+    hl_block *b = w->blocks;
+
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (b == NULL || b->used + size > HL_BLOCK_SIZE) {
+        if ((b = malloc(sizeof(hl_block))) == NULL) {
+            return NULL;
+        }
+        b->next = w->blocks;
+        b->used = 0;
+        w->blocks = b;
+        w->memory += sizeof(hl_block);
+    }
+    b->used += size;
+    return &b->data[b->used - size];
+}
+
+static void free_blocks(hl_block *b)
+{
+    /*
+     * Release a list of blocks.
+     *
+     * param b - First block of the list
+     */
+    while (b != NULL) {
+        hl_block *next = b->next;
+        free(b);
+        b = next;
+    }
+}
+
+static size_t hash_children(hl_node **child)
+{
+    /*
+     * Return the hash of a node with the given children.
+     *
+     * param child - Array of the four children of the node
+     * return - Hash of the node
+     */
+    size_t h = 0;
+
+    for (int i = 0; i < 4; i++) {
+        h = (h ^ (size_t) child[i]) * 0x9e3779b97f4a7c15ull;
+    }
+    return h ^ (h >> 29);
+}
+
+static size_t hash_memo(hl_node *n, int y, int x, int dir)
+{
+    /*
+     * Return the hash of a memoized walk key.
+     *
+     * param n - Node the ant walks through
+     * param y - Row at which the ant enters the node
+     * param x - Column at which the ant enters the node
+     * param dir - Direction in which the ant enters the node
+     * return - Hash of the key
+     */
+    size_t h = (size_t) n * 0x9e3779b97f4a7c15ull;
+
+    h ^= ((size_t) y * 73856093u) ^ ((size_t) x * 19349663u) ^ dir;
+    return h ^ (h >> 29);
+}
+
+static int grow_nodes(hl_world *w)
+{
+    /*
+     * Double the number of node hash buckets and rehash all nodes.
+     *
+     * param w - World whose node table will grow
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    size_t count = w->node_buckets * 2;
+    hl_node **buckets = calloc(count, sizeof(hl_node *));
+
+    if (buckets == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < w->node_buckets; i++) {
+        hl_node *n = w->nodes[i];
+        while (n != NULL) {
+            hl_node *next = n->next;
+            size_t h = hash_children(n->child) & (count - 1);
+            n->next = buckets[h];
+            buckets[h] = n;
+            n = next;
+        }
+    }
+    w->memory += (count - w->node_buckets) * sizeof(hl_node *);
+    free(w->nodes);
+    w->nodes = buckets;
+    w->node_buckets = count;
+    return 0;
+}
+
+static int grow_memos(hl_world *w)
+{
+    /*
+     * Double the number of memo hash buckets and rehash all walks.
+     *
+     * param w - World whose memo table will grow
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    size_t count = w->memo_buckets * 2;
+    hl_memo **buckets = calloc(count, sizeof(hl_memo *));
+
+    if (buckets == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < w->memo_buckets; i++) {
+        hl_memo *m = w->memos[i];
+        while (m != NULL) {
+            hl_memo *next = m->next;
+            size_t h = hash_memo(m->node, m->y, m->x, m->dir) & (count - 1);
+            m->next = buckets[h];
+            buckets[h] = m;
+            m = next;
+        }
+    }
+    w->memory += (count - w->memo_buckets) * sizeof(hl_memo *);
+    free(w->memos);
+    w->memos = buckets;
+    w->memo_buckets = count;
+    return 0;
+}
+
+static hl_node *make_node(hl_world *w, hl_node *nw, hl_node *ne,
+        hl_node *sw, hl_node *se)
+{
+    /*
+     * Return the unique node with the given children, creating it if it
+     * does not exist yet.
+     *
+     * param w - World that holds the node
+     * param nw, ne, sw, se - Children of the node, all of the same level
+     * return - Pointer to the node or NULL if memory could not be allocated
+     */
+    hl_node *child[4] = {nw, ne, sw, se};
+    size_t h = hash_children(child) & (w->node_buckets - 1);
+    hl_node *n;
+
+    for (n = w->nodes[h]; n != NULL; n = n->next) {
+        if (memcmp(n->child, child, sizeof(child)) == 0) {
+            return n;
+        }
+    }
+    if (w->node_count >= w->node_buckets) {
+        if (grow_nodes(w) != 0) {
+            return NULL;
+        }
+        h = hash_children(child) & (w->node_buckets - 1);
+    }
+    if ((n = hl_alloc(w, sizeof(hl_node))) == NULL) {
+        return NULL;
+    }
+    memcpy(n->child, child, sizeof(child));
+    n->level = nw->level + 1;
+    n->color = 0;
+    n->next = w->nodes[h];
+    w->nodes[h] = n;
+    w->node_count++;
+    return n;
+}
+
+static hl_memo *find_memo(hl_world *w, hl_node *n, int y, int x, int dir)
+{
+    /*
+     * Return the memoized walk for the given key, or NULL if there is none.
+     *
+     * param w - World that holds the memo table
+     * param n - Node the ant walks through
+     * param y - Row at which the ant enters the node
+     * param x - Column at which the ant enters the node
+     * param dir - Direction in which the ant enters the node
+     * return - Pointer to the memoized walk or NULL
+     */
+    hl_memo *m = w->memos[hash_memo(n, y, x, dir) & (w->memo_buckets - 1)];
+
+    for (; m != NULL; m = m->next) {
+        if (m->node == n && m->y == y && m->x == x && m->dir == dir) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
+static int add_memo(hl_world *w, hl_node *n, int y, int x, int dir,
+        hl_walk *walk)
+{
+    /*
+     * Memoize a walk that ended with the ant leaving the node.
+     *
+     * param w - World that holds the memo table
+     * param n - Node the ant walked through
+     * param y - Row at which the ant entered the node
+     * param x - Column at which the ant entered the node
+     * param dir - Direction in which the ant entered the node
+     * param walk - Pointer to the result of the walk
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    hl_memo *m;
+    size_t h;
+
+    if (w->memo_count >= w->memo_buckets && grow_memos(w) != 0) {
+        return -1;
+    }
+    if ((m = hl_alloc(w, sizeof(hl_memo))) == NULL) {
+        return -1;
+    }
+    m->node = n;
+    m->result = walk->node;
+    m->steps = walk->steps;
+    m->y = y;
+    m->x = x;
+    m->dir = dir;
+    m->exit_y = walk->y;
+    m->exit_x = walk->x;
+    m->exit_dir = walk->dir;
+    h = hash_memo(n, y, x, dir) & (w->memo_buckets - 1);
+    m->next = w->memos[h];
+    w->memos[h] = m;
+    w->memo_count++;
+    return 0;
+}
+
+static int walk_node(hl_world *w, rule *r, hl_node *n, int y, int x,
+        int dir, unsigned long long budget, hl_walk *walk)
+{
+    /*
+     * Walk the ant through a node until it leaves the node or the step
+     * budget runs out.
+     *
+     * param w - World that holds the node
+     * param r - Pointer to the compiled rule that describes ant behavior
+     * param n - Node to walk through
+     * param y - Row at which the ant enters the node
+     * param x - Column at which the ant enters the node
+     * param dir - Direction in which the ant enters the node
+     * param budget - Maximum number of steps to take, at least 1
+     * param walk - Pointer to the result: the new node, the ant's final
+     *   position (outside the node if it left) and direction, and the
+     *   number of steps taken
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    int half, size;
+    hl_node *child[4];
+    hl_memo *m;
+
+    w->walks++;
+    if (n->level == 0) {
+        transition *t = &r->table[n->color][dir];
+
+        walk->node = &w->leaves[t->next];
+        walk->y = y + t->dy;
+        walk->x = x + t->dx;
+        walk->dir = t->dir;
+        walk->steps = 1;
+        return 0;
+    }
+    m = find_memo(w, n, y, x, dir);
+    if (m != NULL && m->steps <= budget) {
+        walk->node = m->result;
+        walk->y = m->exit_y;
+        walk->x = m->exit_x;
+        walk->dir = m->exit_dir;
+        walk->steps = m->steps;
+        return 0;
+    }
+
+    // Walk child by child until the ant leaves or the budget runs out
+    half = 1 << (n->level - 1);
+    size = half * 2;
+    memcpy(child, n->child, sizeof(child));
+    walk->y = y;
+    walk->x = x;
+    walk->dir = dir;
+    walk->steps = 0;
+    while (walk->y >= 0 && walk->y < size && walk->x >= 0 &&
+            walk->x < size && walk->steps < budget) {
+        int q = (walk->y >= half) * 2 + (walk->x >= half);
+        int oy = (q >> 1) * half, ox = (q & 1) * half;
+        hl_walk sub;
+
+        if (walk_node(w, r, child[q], walk->y - oy, walk->x - ox, walk->dir,
+                    budget - walk->steps, &sub) != 0) {
+            return -1;
+        }
+        child[q] = sub.node;
+        walk->y = sub.y + oy;
+        walk->x = sub.x + ox;
+        walk->dir = sub.dir;
+        walk->steps += sub.steps;
+    }
+    walk->node = make_node(w, child[0], child[1], child[2], child[3]);
+    if (walk->node == NULL) {
+        return -1;
+    }
+    if (walk->y < 0 || walk->y >= size || walk->x < 0 || walk->x >= size) {
+        return add_memo(w, n, y, x, dir, walk);
+    }
+    return 0;
+}
+
+static hl_node *move_node(hl_world *w, hl_node *n)
+{
+    /*
+     * Copy a node of the old node table, and everything under it, into
+     * the world's new table. Each old node's next pointer is NULL until it
+     * has been copied, then points to its copy.
+     *
+     * param w - World being collected
+     * param n - Node to copy
+     * return - Pointer to the copy or NULL if memory could not be allocated
+     */
+    hl_node *child[4];
+
+    if (n->level == 0) {
+        // Leaves live in the world itself
+        return n;
+    }
+    if (n->next != NULL) {
+        return n->next;
+    }
+    for (int i = 0; i < 4; i++) {
+        if ((child[i] = move_node(w, n->child[i])) == NULL) {
+            return NULL;
+        }
+    }
+    n->next = make_node(w, child[0], child[1], child[2], child[3]);
+    return n->next;
+}
+
+static int collect_hashlife(hl_world *w)
+{
+    /*
+     * Free every node that is no longer part of the world and every
+     * memoized walk.
+     *
+     * param w - World to collect
+     * return - 0 on success, -1 if memory could not be allocated, in which
+     *   case the world holds no nodes and can only be freed
+     */
+    hl_node **nodes = w->nodes;
+    hl_block *blocks = w->blocks;
+    hl_node **new_nodes = calloc(INITIAL_BUCKETS, sizeof(hl_node *));
+    hl_memo **new_memos = calloc(INITIAL_BUCKETS, sizeof(hl_memo *));
+
+    if (new_nodes == NULL || new_memos == NULL) {
+        free(new_nodes);
+        free(new_memos);
+        return -1;
+    }
+    // Unlink the old nodes; from now on next points to a node's copy
+    for (size_t i = 0; i < w->node_buckets; i++) {
+        hl_node *n = nodes[i];
+        while (n != NULL) {
+            hl_node *next = n->next;
+            n->next = NULL;
+            n = next;
+        }
+    }
+    free(nodes);
+    free(w->memos);
+    w->nodes = new_nodes;
+    w->node_buckets = INITIAL_BUCKETS;
+    w->node_count = 0;
+    w->memos = new_memos;
+    w->memo_buckets = INITIAL_BUCKETS;
+    w->memo_count = 0;
+    w->blocks = NULL;
+    w->memory = 2 * INITIAL_BUCKETS * sizeof(void *);
+    for (int i = 1; i <= HL_MAX_LEVEL; i++) {
+        if ((w->empty[i] = move_node(w, w->empty[i])) == NULL) {
+            w->root = NULL;
+            break;
+        }
+    }
+    if (w->root != NULL) {
+        w->root = move_node(w, w->root);
+    }
+    free_blocks(blocks);
+    w->collections++;
+    return w->root != NULL ? 0 : -1;
+}
+
+static int copy_tiles(hl_world *w, hl_node *n, grid *g, int y, int x)
+{
+    /*
+     * Color the tiles of a grid like the non-black tiles of a node.
+     *
+     * param w - World that holds the node
+     * param n - Node to copy
+     * param g - Grid to update
+     * param y - Row of the node's top left tile
+     * param x - Column of the node's top left tile
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    int half;
+
+    if (n == w->empty[n->level]) {
+        return 0;
+    }
+    if (n->level == 0) {
+        point p = {y, x};
+
+        return change_tile(g, &p, n->color);
+    }
+    half = 1 << (n->level - 1);
+    for (int i = 0; i < 4; i++) {
+        if (copy_tiles(w, n->child[i], g, y + (i >> 1) * half,
+                    x + (i & 1) * half) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int expand_root(hl_world *w)
+{
+    /*
+     * Double the size of the world, keeping the old root centered.
+     *
+     * param w - World to expand
+     * return - 0 on success, -1 if memory could not be allocated or the
+     *   world reached HL_MAX_LEVEL
+     */
+    hl_node *e = w->empty[w->root->level - 1];
+    hl_node **c = w->root->child;
+    hl_node *nw, *ne, *sw, *se;
+
+    if (w->root->level == HL_MAX_LEVEL) {
+        return -1;
+    }
+    if ((nw = make_node(w, e, e, e, c[0])) == NULL ||
+            (ne = make_node(w, e, e, c[1], e)) == NULL ||
+            (sw = make_node(w, e, c[2], e, e)) == NULL ||
+            (se = make_node(w, c[3], e, e, e)) == NULL ||
+            (w->root = make_node(w, nw, ne, sw, se)) == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+int advance_hashlife(hl_world *w, ant *a, rule *r,
+        unsigned long long *step_count, unsigned long long steps)
+{
+    /*
+     * Advance the ant a number of steps.
+     *
+     * param w - World to be updated
+     * param a - Pointer to the ant
+     * param r - Pointer to the compiled rule that describes ant behavior
+     * param step_count - Pointer to the ant's step count, advanced by the
+     *   number of steps taken
+     * param steps - Number of steps to advance
+     * return - 0 on success, 1 if memoization stopped paying off (see
+     *   hl_world) before all steps were taken, -1 if memory could not be
+     *   allocated or the ant left the largest supported world
+     */
+    unsigned long long window = 0;
+    unsigned long long walks = w->walks;
+
+    while (steps > 0) {
+        int offset = 1 << (w->root->level - 1);
+        hl_walk walk;
+
+        // Collect between walks, when no node is held on the stack
+        if (w->memory > w->memory_cap) {
+            if (collect_hashlife(w) != 0) {
+                return -1;
+            }
+            if (w->memory > w->memory_cap / 2) {
+                return 1;
+            }
+        }
+        if (a->pos.y < -offset || a->pos.y >= offset ||
+                a->pos.x < -offset || a->pos.x >= offset) {
+            if (expand_root(w) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (walk_node(w, r, w->root, a->pos.y + offset, a->pos.x + offset,
+                    a->dir, steps < HL_SLICE_STEPS ? steps : HL_SLICE_STEPS,
+                    &walk) != 0) {
+            return -1;
+        }
+        w->root = walk.node;
+        set_point(&a->pos, walk.y - offset, walk.x - offset);
+        a->dir = walk.dir;
+        *step_count += walk.steps;
+        steps -= walk.steps;
+        window += walk.steps;
+        if (w->walks - walks >= HL_CHECK_WALKS) {
+            // Each walk costs far more than a step on the grid
+            if (window < (w->walks - walks) * HL_STEPS_PER_WALK) {
+                return 1;
+            }
+            window = 0;
+            walks = w->walks;
+        }
+    }
+    return 0;
+}
+
+int copy_hashlife(hl_world *w, grid *g)
+{
+    /*
+     * Copy the tiles of the world into a grid, e.g. to continue a run on
+     * the grid once the world outgrew its memory cap.
+     *
+     * param w - World to copy
+     * param g - Blank grid to be updated
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    int offset = 1 << (w->root->level - 1);
+
+    return copy_tiles(w, w->root, g, -offset, -offset);
+}
+
+void free_hashlife(hl_world *w)
+{
+    /*
+     * Release all memory held by the world.
+     *
+     * param w - World to free
+     */
+    free_blocks(w->blocks);
+    free(w->nodes);
+    free(w->memos);
+    memset(w, 0, sizeof(hl_world));
+}
+
+int init_hashlife(hl_world *w)
+{
+    /*
+     * Initialize an empty world.
+     *
+     * param w - World to be initialized
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    memset(w, 0, sizeof(hl_world));
+    w->nodes = calloc(INITIAL_BUCKETS, sizeof(hl_node *));
+    w->memos = calloc(INITIAL_BUCKETS, sizeof(hl_memo *));
+    if (w->nodes == NULL || w->memos == NULL) {
+        free_hashlife(w);
+        return -1;
+    }
+    w->node_buckets = INITIAL_BUCKETS;
+    w->memo_buckets = INITIAL_BUCKETS;
+    w->memory = 2 * INITIAL_BUCKETS * sizeof(void *);
+    w->memory_cap = HL_MEMORY_CAP;
+    for (int i = 0; i < MAX_COLORS; i++) {
+        w->leaves[i].color = i;
+    }
+    w->empty[0] = &w->leaves[0];
+    for (int i = 1; i <= HL_MAX_LEVEL; i++) {
+        hl_node *e = w->empty[i - 1];
+        if ((w->empty[i] = make_node(w, e, e, e, e)) == NULL) {
+            free_hashlife(w);
+            return -1;
+        }
+    }
+    w->root = w->empty[HL_MIN_LEVEL];
+    return 0;
+}
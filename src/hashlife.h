@@ -0,0 +1,99 @@
+#ifndef HASHLIFE_H
+#define HASHLIFE_H
+
+/*
+ * hashlife.h
+ *
+ * Memoized quadtree backend. The world is a tree of hash-consed nodes so
+ * that identical regions share a single node, and the ant's walk through a
+ * node is cached by (node, entry position, entry direction).
+ */
+
+#include <stddef.h>
+
+#include "ant.h"
+#include "grid.h"
+#include "point.h"
+#include "rule.h"
+
+#define HL_MIN_LEVEL 3
+#define HL_MAX_LEVEL 30
+#define HL_BLOCK_SIZE (1 << 20)
+// Memory use at which the world is garbage collected
+#define HL_MEMORY_CAP ((size_t) 512 << 20)
+// Most steps walked between two checks of the memory use and work done
+#define HL_SLICE_STEPS (1ULL << 16)
+// Walks over which the work done per step is measured
+#define HL_CHECK_WALKS (1ULL << 20)
+// Steps per walk below which stepping on a grid is faster
+#define HL_STEPS_PER_WALK 16
+
+/*
+ * A square of 2^level x 2^level tiles. Level 0 nodes are single tiles;
+ * higher levels have four children in the order NW, NE, SW, SE.
+ */
+typedef struct hl_node {
+    struct hl_node *child[4];
+    struct hl_node *next;
+    int level;
+    int color;
+} hl_node;
+
+/*
+ * The result of an ant entering node at (y, x) facing dir: it leaves the
+ * node at (exit_y, exit_x) facing exit_dir after steps steps, having
+ * turned the node into result. Positions are relative to the node.
+ */
+typedef struct hl_memo {
+    struct hl_memo *next;
+    hl_node *node;
+    hl_node *result;
+    unsigned long long steps;
+    int y, x, dir;
+    int exit_y, exit_x, exit_dir;
+} hl_memo;
+
+typedef struct hl_block {
+    struct hl_block *next;
+    size_t used;
+    unsigned char data[HL_BLOCK_SIZE];
+} hl_block;
+
+/*
+ * The root node covers tiles -2^(level-1) to 2^(level-1) - 1 on both axes
+ * and grows as the ant approaches its edge. A world caches the behavior of
+ * one rule and must always be stepped with it.
+ *
+ * Nodes and walks are never freed one by one. Once the world uses more
+ * than memory_cap bytes, the walks are dropped and only the nodes still
+ * part of the world are kept. If those alone take more than half the cap,
+ * or if each walk advances the ant fewer than HL_STEPS_PER_WALK steps,
+ * too few walks are reused and stepping stops so the caller can continue
+ * on a grid, which is then faster (see copy_hashlife).
+ */
+typedef struct {
+    hl_node *root;
+    hl_node leaves[MAX_COLORS];
+    hl_node *empty[HL_MAX_LEVEL + 1];
+    hl_node **nodes;
+    size_t node_buckets;
+    size_t node_count;
+    hl_memo **memos;
+    size_t memo_buckets;
+    size_t memo_count;
+    hl_block *blocks;
+    size_t memory;
+    size_t memory_cap;
+    // Number of garbage collections so far
+    int collections;
+    // Walks through nodes so far, memoized or not, to measure the work
+    unsigned long long walks;
+} hl_world;
+
+int advance_hashlife(hl_world *w, ant *a, rule *r,
+        unsigned long long *step_count, unsigned long long steps);
+int copy_hashlife(hl_world *w, grid *g);
+void free_hashlife(hl_world *w);
+int init_hashlife(hl_world *w);
+
+#endif
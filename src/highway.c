@@ -0,0 +1,427 @@
+/*
+ * highway.c
+ *
+ * Many patterns eventually settle into a "highway": the ant repeats a
+ * fixed sequence of moves whose net displacement carries it into blank
+ * territory forever. Once a period P with displacement D is found and
+ * proven, whole periods are applied by writing the trail directly
+ * instead of simulating every step.
+ *
+ * A candidate period is taken from the ant's recent direction history and
+ * proven by simulating one more period T..T+P while recording the values
+ * of every tile the ant visits. The highway continues forever if
+ *
+ *     grid[T+P](y + D) == grid[T](y)
+ *
+ * for every tile y in F, F+D, F+2D, ... where F is the set of tiles
+ * visited during the period. Outside the bounding box of allocated chunks
+ * both sides are 0, so only finitely many tiles need to be compared.
+ */
+
+#include <limits.h>
+#include <string.h>
+
+#include "highway.h"
+
+static unsigned int hash_cell(point *p)
+{
+    /*
+     * Return the footprint slot at which to start probing for a tile.
+     *
+     * param p - Pointer to the coordinates of the tile
+     * return - Index into the footprint slot array
+     */
+    unsigned int h = (unsigned int) p->y * 73856093u ^
+        (unsigned int) p->x * 19349663u;
+
+    return (h ^ (h >> 16)) & (FOOTPRINT_SLOTS - 1);
+}
+
+static int find_cell(highway *h, point *p)
+{
+    /*
+     * Return the index of a tile in the recorded footprint.
+     *
+     * param h - Highway whose footprint will be searched
+     * param p - Pointer to the coordinates of the tile
+     * return - Index into h->cells, or -1 if the tile was not visited
+     */
+    for (unsigned int i = hash_cell(p); h->slots[i] != 0;
+            i = (i + 1) & (FOOTPRINT_SLOTS - 1)) {
+        point *q = &h->cells[h->slots[i] - 1];
+        if (q->y == p->y && q->x == p->x) {
+            return h->slots[i] - 1;
+        }
+    }
+    return -1;
+}
+
+static void add_cell(highway *h, point *p, int value)
+{
+    /*
+     * Record the first visit of the ant to a tile during verification.
+     *
+     * param h - Highway being verified
+     * param p - Pointer to the coordinates of the tile
+     * param value - Value of the tile before the ant changed it
+     */
+    unsigned int i = hash_cell(p);
+
+    while (h->slots[i] != 0) {
+        point *q = &h->cells[h->slots[i] - 1];
+        if (q->y == p->y && q->x == p->x) {
+            return;
+        }
+        i = (i + 1) & (FOOTPRINT_SLOTS - 1);
+    }
+    h->cells[h->cell_count] = *p;
+    h->first_value[h->cell_count] = value;
+    h->slots[i] = ++h->cell_count;
+}
+
+static int find_period(highway *h, unsigned long long step_count)
+{
+    /*
+     * Look for the smallest period P >= h->min_period such that the last
+     * PERIOD_REPEATS * P directions of the ant repeat every P steps.
+     *
+     * param h - Highway holding the direction history
+     * param step_count - Number of steps taken so far
+     * return - The period, or 0 if there is none
+     */
+    for (int p = h->min_period; p <= MAX_PERIOD; p++) {
+        unsigned long long window = (unsigned long long) p * PERIOD_REPEATS;
+        unsigned long long i;
+
+        if (window > step_count || window > HISTORY_LEN) {
+            break;
+        }
+        for (i = step_count - window + p; i < step_count; i++) {
+            if (h->history[i % HISTORY_LEN] !=
+                    h->history[(i - p) % HISTORY_LEN]) {
+                break;
+            }
+        }
+        if (i == step_count) {
+            return p;
+        }
+    }
+    return 0;
+}
+
+static int boxes_overlap(point *min_a, point *max_a, point *min_b,
+        point *max_b)
+{
+    /*
+     * Return 1 (true) if two inclusive boxes of tiles overlap.
+     *
+     * param min_a - Pointer to the top-left tile of the first box
+     * param max_a - Pointer to the bottom-right tile of the first box
+     * param min_b - Pointer to the top-left tile of the second box
+     * param max_b - Pointer to the bottom-right tile of the second box
+     * return - 1 (true) if the boxes share a tile, 0 (false) if not
+     */
+    return min_a->y <= max_b->y && min_b->y <= max_a->y &&
+        min_a->x <= max_b->x && min_b->x <= max_a->x;
+}
+
+static int check_highway(grid *g, highway *h)
+{
+    /*
+     * Check that the verified period repeats forever (see top of file).
+     *
+     * param g - Grid at the end of the verified period
+     * param h - Highway holding the recorded footprint and displacement
+     * return - 1 (true) if the ant is on a highway, 0 (false) if not
+     */
+    point d = h->displacement;
+    point f_min = h->cells[0], f_max = h->cells[0];
+    point b_min, b_max;
+
+    for (int i = 1; i < h->cell_count; i++) {
+        point *c = &h->cells[i];
+        f_min.y = c->y < f_min.y ? c->y : f_min.y;
+        f_min.x = c->x < f_min.x ? c->x : f_min.x;
+        f_max.y = c->y > f_max.y ? c->y : f_max.y;
+        f_max.x = c->x > f_max.x ? c->x : f_max.x;
+    }
+    /*
+     * Tiles y for which y or y + D lies inside the allocated chunks. The
+     * footprint was just written, so the grid has at least one chunk.
+     */
+    set_point(&b_min, g->chunk_min.y * CHUNK_SIZE - (d.y > 0 ? d.y : 0),
+            g->chunk_min.x * CHUNK_SIZE - (d.x > 0 ? d.x : 0));
+    set_point(&b_max,
+            g->chunk_max.y * CHUNK_SIZE + CHUNK_MASK -
+            (d.y < 0 ? d.y : 0),
+            g->chunk_max.x * CHUNK_SIZE + CHUNK_MASK -
+            (d.x < 0 ? d.x : 0));
+
+    for (int n = 0; ; n++) {
+        point lo = {f_min.y + n * d.y, f_min.x + n * d.x};
+        point hi = {f_max.y + n * d.y, f_max.x + n * d.x};
+
+        if (!boxes_overlap(&lo, &hi, &b_min, &b_max)) {
+            break;
+        }
+        for (int i = 0; i < h->cell_count; i++) {
+            point y = {h->cells[i].y + n * d.y, h->cells[i].x + n * d.x};
+            point y_next = add_points(&y, &d);
+            int j = find_cell(h, &y);
+            int before = j >= 0 ? h->first_value[j] : get_tile(g, &y);
+
+            if (get_tile(g, &y_next) != before) {
+                return 0;
+            }
+        }
+        if (d.y == 0 && d.x == 0) {
+            break;
+        }
+    }
+    return 1;
+}
+
+static int finish_verify(grid *g, ant *a, highway *h,
+        unsigned long long step_count)
+{
+    /*
+     * Decide whether the period that was just simulated proves a highway.
+     *
+     * param g - Grid at the end of the period
+     * param a - Pointer to the ant at the end of the period
+     * param h - Highway being verified
+     * param step_count - Number of steps taken so far
+     * return - 1 (true) if a highway was confirmed, 0 (false) if not
+     */
+    point neg_d;
+
+    set_point(&h->displacement, a->pos.y - h->start_pos.y,
+            a->pos.x - h->start_pos.x);
+    if (a->dir != h->start_dir || !check_highway(g, h)) {
+        return 0;
+    }
+    set_point(&neg_d, -h->displacement.y, -h->displacement.x);
+    for (int i = 0; i < h->cell_count; i++) {
+        point behind = add_points(&h->cells[i], &neg_d);
+        h->final_value[i] = get_tile(g, &h->cells[i]);
+        h->leading[i] = find_cell(h, &behind) < 0;
+    }
+    h->base_step = step_count;
+    return 1;
+}
+
+static unsigned long long get_room(int v, int d)
+{
+    /*
+     * Return how many times d can be added to v before it leaves the range
+     * of an int.
+     *
+     * param v - Starting coordinate
+     * param d - Displacement added each time
+     * return - Largest count, or ULLONG_MAX if d is 0
+     */
+    if (d > 0) {
+        return (INT_MAX - (long long) v) / d;
+    } else if (d < 0) {
+        return ((long long) v - INT_MIN) / -(long long) d;
+    }
+    return ULLONG_MAX;
+}
+
+static int jump_highway(grid *g, ant *a, highway *h,
+        unsigned long long done, unsigned long long periods)
+{
+    /*
+     * Apply whole periods of a confirmed highway without simulating them.
+     *
+     * param g - Grid to write the trail to
+     * param a - Pointer to the ant, which must be at a period boundary
+     * param h - Confirmed highway
+     * param done - Periods already completed since h->base_step
+     * param periods - Number of periods to apply
+     * return - 0 on success, -1 if memory could not be allocated or the
+     *   ant or its trail would leave the range of int coordinates, in
+     *   which case no period is applied
+     */
+    point d = h->displacement;
+
+    if (periods > get_room(a->pos.y, d.y) ||
+            periods > get_room(a->pos.x, d.x)) {
+        return -1;
+    }
+    for (int i = 0; i < h->cell_count; i++) {
+        if (done + periods > get_room(h->cells[i].y, d.y) ||
+                done + periods > get_room(h->cells[i].x, d.x)) {
+            return -1;
+        }
+    }
+
+    for (unsigned long long n = done + 1; n <= done + periods; n++) {
+        int last = n == done + periods;
+
+        for (int i = 0; i < h->cell_count; i++) {
+            point p;
+
+            // Tiles that a later period revisits are written by it instead
+            if (!last && !h->leading[i]) {
+                continue;
+            }
+            set_point(&p, h->cells[i].y + (long long) n * d.y,
+                    h->cells[i].x + (long long) n * d.x);
+            if (change_tile(g, &p, h->final_value[i]) != 0) {
+                return -1;
+            }
+        }
+    }
+    a->pos.y += (long long) periods * d.y;
+    a->pos.x += (long long) periods * d.x;
+    return 0;
+}
+
+int advance_ant(grid *g, ant *a, rule *r, highway *h,
+        unsigned long long *step_count, unsigned long long steps)
+{
+    /*
+     * Advance the ant a number of steps, detecting a highway on the way
+     * and skipping over whole periods of it once one is confirmed.
+     *
+     * param g - Grid to be updated
+     * param a - Pointer to the ant
+     * param r - Pointer to the compiled rule that describes ant behavior
+     * param h - Highway detection state carried between calls
+     * param step_count - Pointer to the ant's step count, advanced by the
+     *   number of steps taken
+     * param steps - Number of steps to advance
+     * return - 0 on success, -1 if memory could not be allocated or the
+     *   ant left the range of int coordinates
+     */
+    unsigned long long end = *step_count + steps;
+
+    while (*step_count < end) {
+        unsigned long long left = end - *step_count;
+
+        if (h->state == HIGHWAY_FOUND) {
+            unsigned long long since = *step_count - h->base_step;
+            unsigned long long to_boundary = (h->period - since % h->period) %
+                h->period;
+
+            if (to_boundary == 0 && left >= (unsigned long long) h->period) {
+                unsigned long long periods = left / h->period;
+
+                if (jump_highway(g, a, h, since / h->period, periods) != 0) {
+                    return -1;
+                }
+                *step_count += periods * h->period;
+                continue;
+            }
+            if (to_boundary == 0 || to_boundary > left) {
+                to_boundary = left;
+            }
+            if (step_grid(g, a, r, step_count, to_boundary) != 0) {
+                return -1;
+            }
+        } else if (h->state == HIGHWAY_VERIFYING) {
+            int p = h->period;
+            unsigned long long i = *step_count;
+            int value = get_tile(g, &a->pos);
+
+            add_cell(h, &a->pos, value);
+            if (update_grid(g, a, r) != 0) {
+                return -1;
+            }
+            h->history[i % HISTORY_LEN] = a->dir;
+            (*step_count)++;
+            if (a->dir != h->history[(i - p) % HISTORY_LEN]) {
+                // The ant left the candidate cycle
+                h->state = HIGHWAY_SEARCHING;
+                h->min_period = 1;
+            } else if (*step_count == h->verify_start + p) {
+                if (finish_verify(g, a, h, *step_count)) {
+                    h->state = HIGHWAY_FOUND;
+                } else {
+                    h->state = HIGHWAY_SEARCHING;
+                    h->min_period = p + 1;
+                }
+            }
+        } else {
+            unsigned long long n = h->next_check - *step_count;
+            unsigned long long quiet;
+            int p;
+
+            if (n > left) {
+                n = left;
+            }
+            // Only the last HISTORY_LEN directions before a check are read
+            quiet = h->next_check - *step_count > HISTORY_LEN ?
+                h->next_check - *step_count - HISTORY_LEN : 0;
+            quiet = quiet < n ? quiet : n;
+            if (step_grid(g, a, r, step_count, quiet) != 0) {
+                return -1;
+            }
+            for (unsigned long long i = quiet; i < n; i++) {
+                if (update_grid(g, a, r) != 0) {
+                    return -1;
+                }
+                h->history[*step_count % HISTORY_LEN] = a->dir;
+                (*step_count)++;
+            }
+            if (*step_count != h->next_check) {
+                continue;
+            }
+            h->next_check += CHECK_INTERVAL;
+            if ((p = find_period(h, *step_count)) == 0) {
+                h->min_period = 1;
+                continue;
+            }
+            // Simulate one more period while recording its footprint
+            h->state = HIGHWAY_VERIFYING;
+            h->period = p;
+            h->verify_start = *step_count;
+            h->start_pos = a->pos;
+            h->start_dir = a->dir;
+            h->cell_count = 0;
+            memset(h->slots, 0, sizeof(h->slots));
+        }
+    }
+    return 0;
+}
+
+void init_highway(highway *h)
+{
+    /*
+     * Initialize highway detection for an ant that has not moved yet.
+     *
+     * param h - Highway detection state to initialize
+     */
+    memset(h, 0, sizeof(highway));
+    h->state = HIGHWAY_SEARCHING;
+    h->next_check = CHECK_INTERVAL;
+    h->min_period = 1;
+}
+
+void plan_final_check(highway *h, unsigned long long step_count,
+        unsigned long long end)
+{
+    /*
+     * Move the next check forward when the run ends before it, so that a
+     * highway is still looked for near the end of a short run. The check
+     * leaves room for the history of a period and one more period to
+     * verify it.
+     *
+     * param h - Highway detection state, still searching
+     * param step_count - Number of steps taken so far
+     * param end - Step at which the run ends
+     */
+    unsigned long long room;
+    unsigned long long check;
+
+    if (end <= step_count) {
+        return;
+    }
+    room = (end - step_count) / (PERIOD_REPEATS + 1);
+    room = room < MAX_PERIOD ? room : MAX_PERIOD;
+    check = end - room;
+    if (check > step_count && check < h->next_check) {
+        h->next_check = check;
+    }
+}
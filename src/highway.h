@@ -0,0 +1,60 @@
+#ifndef HIGHWAY_H
+#define HIGHWAY_H
+
+/*
+ * highway.h
+ *
+ * Detection of periodic "highways" and fast-forwarding along them.
+ */
+
+#include "ant.h"
+#include "grid.h"
+#include "point.h"
+#include "rule.h"
+
+#define HISTORY_LEN 8192
+#define MAX_PERIOD 2048
+#define PERIOD_REPEATS 3
+#define CHECK_INTERVAL 65536
+#define FOOTPRINT_SLOTS 4096
+
+enum highway_state {
+    HIGHWAY_SEARCHING,
+    HIGHWAY_VERIFYING,
+    HIGHWAY_FOUND
+};
+
+typedef struct {
+    enum highway_state state;
+    // Ant direction after each step, indexed by step count
+    unsigned char history[HISTORY_LEN];
+    unsigned long long next_check;
+    int min_period;
+    // Candidate or confirmed period and displacement per period
+    int period;
+    point displacement;
+    // Step at which the highway was confirmed
+    unsigned long long base_step;
+    // Ant state at the start of the period being verified
+    unsigned long long verify_start;
+    point start_pos;
+    int start_dir;
+    /*
+     * Tiles visited during the verified period, their values before and
+     * after it, and whether the tile one period behind them was visited
+     */
+    point cells[MAX_PERIOD];
+    unsigned char first_value[MAX_PERIOD];
+    unsigned char final_value[MAX_PERIOD];
+    unsigned char leading[MAX_PERIOD];
+    int cell_count;
+    int slots[FOOTPRINT_SLOTS];
+} highway;
+
+int advance_ant(grid *g, ant *a, rule *r, highway *h,
+        unsigned long long *step_count, unsigned long long steps);
+void init_highway(highway *h);
+void plan_final_check(highway *h, unsigned long long step_count,
+        unsigned long long end);
+
+#endif
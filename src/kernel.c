@@ -0,0 +1,266 @@
+/*
+ * kernel.c
+ *
+ * Each kernel is generated by the KERNEL macro from the turns of its
+ * pattern, so its transition table is a compile-time constant. The shared
+ * loop is forced inline into every kernel, letting the compiler fold the
+ * table, the tile width and the moves into each one.
+ *
+ * An ant d tiles inside every edge of its chunk cannot leave it in its
+ * next d + 1 steps, since each step moves it one tile. The loop takes
+ * such batches with no bounds checks and only looks at where the ant is
+ * between them, so it checks once every few dozen steps in the middle of
+ * a chunk and once a step along its edges. Patterns without a kernel of
+ * their own run the same loop on their compiled table (step_table), which
+ * also marks visited tiles on grids that track them.
+ *
+ * Two-color patterns have no kernels here: the bitboard path in grid.c
+ * already runs them faster than a byte-wise kernel does.
+ */
+
+#include <string.h>
+#include <strings.h>
+
+#include "kernel.h"
+
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+// Turns, as added to the ant's direction
+#define TURN_L 3
+#define TURN_R 1
+#define TURN_U 2
+#define TURN_N 0
+
+#define KERNEL_DY(dir) ((dir) == ANT_UP ? -1 : (dir) == ANT_DOWN ? 1 : 0)
+#define KERNEL_DX(dir) ((dir) == ANT_LEFT ? -1 : (dir) == ANT_RIGHT ? 1 : 0)
+#define KERNEL_MOVE(turn, next, dir) {((dir) + (turn)) & 3, (next), \
+    KERNEL_DY(((dir) + (turn)) & 3), KERNEL_DX(((dir) + (turn)) & 3)}
+
+/*
+ * Row of the transition table for a tile color that turns the ant by turn
+ * and becomes color next.
+ */
+#define COLOR(turn, next) {KERNEL_MOVE(TURN_##turn, next, 0), \
+    KERNEL_MOVE(TURN_##turn, next, 1), KERNEL_MOVE(TURN_##turn, next, 2), \
+    KERNEL_MOVE(TURN_##turn, next, 3)}
+
+/*
+ * Define the kernel step_<name> for a pattern stored in tiles of bits
+ * bits, from one COLOR row per color of the pattern. The rows are repeated
+ * eight times, which covers the sixteen tile values (MAX_COLORS) for any
+ * pattern of two colors or more, so that like compile_rule every tile
+ * value reads the row of its value modulo the pattern length.
+ */
+#define KERNEL(name, bits, ...) \
+    static const transition name##_table[][4] = {__VA_ARGS__, \
+        __VA_ARGS__, __VA_ARGS__, __VA_ARGS__, __VA_ARGS__, __VA_ARGS__, \
+        __VA_ARGS__, __VA_ARGS__}; \
+    static int step_##name(grid *g, ant *a, unsigned long long *steps) \
+    { \
+        return run_kernel(g, a, steps, name##_table, bits, 0); \
+    }
+
+typedef struct {
+    char *pattern;
+    int tile_bits;
+    step_kernel step;
+} kernel_entry;
+
+static ALWAYS_INLINE void kernel_step(unsigned char *tiles, int *y, int *x,
+        int *dir, const transition table[][4], int bits)
+{
+    /*
+     * Take one step inside a chunk without checking its bounds.
+     *
+     * param tiles - Packed tiles of the chunk
+     * param y - Pointer to the ant's row within the chunk
+     * param x - Pointer to the ant's column within the chunk
+     * param dir - Pointer to the ant's direction
+     * param table - Transition table of the pattern
+     * param bits - Bits per tile
+     */
+    unsigned int i = CHUNK_INDEX(*y, *x);
+    unsigned int per_byte = 8 / bits;
+    int shift = (i % per_byte) * bits;
+    unsigned char *byte = &tiles[i / per_byte];
+    int value = (*byte >> shift) & ((1 << bits) - 1);
+    const transition *t = &table[value][*dir];
+
+    *byte ^= (value ^ t->next) << shift;
+    *dir = t->dir;
+    *y += t->dy;
+    *x += t->dx;
+}
+
+static ALWAYS_INLINE void kernel_visit(grid *g, chunk *c, int cy, int cx,
+        int y, int x)
+{
+    /*
+     * Mark the tile under the ant as visited.
+     *
+     * param g - Grid that tracks visited tiles
+     * param c - Chunk the ant is in
+     * param cy - Row of the chunk
+     * param cx - Column of the chunk
+     * param y - Ant's row within the chunk
+     * param x - Ant's column within the chunk
+     */
+    unsigned int i = CHUNK_INDEX(y, x);
+    unsigned char *v = &c->tiles[g->visited_offset + (i >> 3)];
+
+    if (!(*v & (1 << (i & 7)))) {
+        point p = {cy * CHUNK_SIZE + y, cx * CHUNK_SIZE + x};
+
+        *v |= 1 << (i & 7);
+        add_visited(g, &p);
+    }
+}
+
+static ALWAYS_INLINE int run_kernel(grid *g, ant *a,
+        unsigned long long *steps, const transition table[][4], int bits,
+        int visited)
+{
+    /*
+     * Advance the ant chunk by chunk, like step_grid.
+     *
+     * param g - Grid to be updated
+     * param a - Pointer to the ant
+     * param steps - Pointer to the number of steps to advance, counted
+     *   down as they are taken
+     * param table - Transition table of the pattern
+     * param bits - Bits per tile
+     * param visited - 1 (true) to mark visited tiles
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    unsigned long long left = *steps;
+
+    while (left > 0) {
+        int cy = a->pos.y >> CHUNK_SHIFT;
+        int cx = a->pos.x >> CHUNK_SHIFT;
+        chunk *c = get_chunk(g, cy, cx);
+        int y = a->pos.y & CHUNK_MASK;
+        int x = a->pos.x & CHUNK_MASK;
+        int dir = a->dir;
+
+        if (c == NULL) {
+            *steps = left;
+            return -1;
+        }
+        while (left > 0 && (unsigned int) (y | x) < CHUNK_SIZE) {
+            int d = y < x ? y : x;
+            unsigned long long n;
+
+            d = CHUNK_MASK - y < d ? CHUNK_MASK - y : d;
+            d = CHUNK_MASK - x < d ? CHUNK_MASK - x : d;
+            n = (unsigned long long) d + 1;
+            n = n < left ? n : left;
+            left -= n;
+            for (; n > 0; n--) {
+                if (visited) {
+                    kernel_visit(g, c, cy, cx, y, x);
+                }
+                kernel_step(c->tiles, &y, &x, &dir, table, bits);
+            }
+        }
+        a->dir = dir;
+        a->pos.y = cy * CHUNK_SIZE + y;
+        a->pos.x = cx * CHUNK_SIZE + x;
+    }
+    *steps = 0;
+    return 0;
+}
+
+KERNEL(rllr, 4, COLOR(R, 1), COLOR(L, 2), COLOR(L, 3), COLOR(R, 0))
+KERNEL(lrrrrrllr, 4, COLOR(L, 1), COLOR(R, 2), COLOR(R, 3), COLOR(R, 4),
+        COLOR(R, 5), COLOR(R, 6), COLOR(L, 7), COLOR(L, 8), COLOR(R, 0))
+KERNEL(rrlllrlllrrr, 4, COLOR(R, 1), COLOR(R, 2), COLOR(L, 3),
+        COLOR(L, 4), COLOR(L, 5), COLOR(R, 6), COLOR(L, 7), COLOR(L, 8),
+        COLOR(L, 9), COLOR(R, 10), COLOR(R, 11), COLOR(R, 0))
+
+static const kernel_entry kernels[] = {
+    {"RLLR", 4, step_rllr},
+    {"LRRRRRLLR", 4, step_lrrrrrllr},
+    {"RRLLLRLLLRRR", 4, step_rrlllrlllrrr}
+};
+#define NUM_KERNELS (int) (sizeof(kernels) / sizeof(kernels[0]))
+
+/*
+ * The kernel loop for a table only known at run time, one per tile width,
+ * and one per tile width that also marks visited tiles
+ */
+#define TABLE_KERNELS(bits) \
+    static int step_table_##bits(grid *g, ant *a, \
+            unsigned long long *steps, const transition table[][4]) \
+    { \
+        return run_kernel(g, a, steps, table, bits, 0); \
+    } \
+    static int step_visited_##bits(grid *g, ant *a, \
+            unsigned long long *steps, const transition table[][4]) \
+    { \
+        return run_kernel(g, a, steps, table, bits, 1); \
+    }
+
+TABLE_KERNELS(1)
+TABLE_KERNELS(4)
+TABLE_KERNELS(8)
+
+step_kernel find_kernel(char *pattern, int tile_bits)
+{
+    /*
+     * Return the specialized kernel of a pattern.
+     *
+     * param pattern - String pattern that determines the ant's behavior
+     * param tile_bits - Bits per tile of the grid the ant walks on
+     * return - The kernel, or NULL if the pattern has none for tiles of
+     *   this width
+     */
+    for (int i = 0; i < NUM_KERNELS; i++) {
+        if (kernels[i].tile_bits == tile_bits &&
+                strcasecmp(kernels[i].pattern, pattern) == 0) {
+            return kernels[i].step;
+        }
+    }
+    return NULL;
+}
+
+int step_table(grid *g, ant *a, rule *r, unsigned long long *steps)
+{
+    /*
+     * Advance an ant with any pattern in the kernel loop, reading turns
+     * from the pattern's compiled table. The tile width is still fixed
+     * at compile time for each of the widths a grid can have.
+     *
+     * param g - Grid, not tracking color counts
+     * param a - Pointer to the ant
+     * param r - Pointer to the compiled rule that describes ant behavior
+     * param steps - Pointer to the number of steps to advance, counted
+     *   down as they are taken
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    transition table[MAX_COLORS][4];
+
+    // A local copy of the table cannot alias the tiles being written
+    memcpy(table, r->table, sizeof(table));
+    if (g->track_visited) {
+        switch (g->tile_bits) {
+            case 1:
+                return step_visited_1(g, a, steps, table);
+            case 4:
+                return step_visited_4(g, a, steps, table);
+            default:
+                return step_visited_8(g, a, steps, table);
+        }
+    }
+    switch (g->tile_bits) {
+        case 1:
+            return step_table_1(g, a, steps, table);
+        case 4:
+            return step_table_4(g, a, steps, table);
+        default:
+            return step_table_8(g, a, steps, table);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+/*
+ * kernel.h
+ *
+ * Step loops specialized for common patterns.
+ */
+
+#include "ant.h"
+#include "grid.h"
+#include "rule.h"
+
+/*
+ * Advance an ant a number of steps on a grid that tracks neither visited
+ * tiles nor color counts, counting *steps down as they are taken. Returns
+ * 0 on success, -1 if memory could not be allocated.
+ */
+typedef int (*step_kernel)(grid *g, ant *a, unsigned long long *steps);
+
+step_kernel find_kernel(char *pattern, int tile_bits);
+int step_table(grid *g, ant *a, rule *r, unsigned long long *steps);
+
+#endif
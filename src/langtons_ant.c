@@ -18,14 +18,49 @@
  */
 
 #include <ctype.h>
+#include <errno.h>
 #include <limits.h>
 #include <ncurses.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "ant.h"
+#include "channel.h"
+#include "colony.h"
+#include "ensemble.h"
+#include "export.h"
 #include "grid.h"
+#include "hashlife.h"
+#include "highway.h"
 #include "point.h"
+#include "render.h"
+#include "rule.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "sweep.h"
+#include "trajectory.h"
+
+// Changed tiles tracked between frames before falling back to a full redraw
+#define DIRTY_CAPACITY 4096
+
+// Target frame rate of the interactive view
+#define FPS 30
+#define FRAME_NS (1000000000L / FPS)
+// Time each batch of steps should take at full speed
+#define STEP_SLICE_NS (FRAME_NS / 8)
+
+// Frames in flight from the simulation thread, and pending commands to it
+#define FRAME_SLOTS 2
+#define COMMAND_SLOTS 64
+
+enum backend {
+    BACKEND_GRID,
+    BACKEND_HASHLIFE
+};
 
 enum game_state {
     RUNNING,
@@ -33,6 +68,114 @@ enum game_state {
     GAME_OVER
 };
 
+/*
+ * Simulation speed: run steps steps once every frames frames. A speed of
+ * 0 steps runs the ant for as long as each frame lasts.
+ */
+typedef struct {
+    char key;
+    char *label;
+    unsigned long long steps;
+    int frames;
+} speed_level;
+
+static const speed_level speeds[] = {
+    {'1', "slow", 1, FPS},
+    {'2', "medium", 1, FPS / 2},
+    {'3', "fast", 1, FPS / 10},
+    {'4', "x10", 10, 1},
+    {'5', "x100", 100, 1},
+    {'6', "max", 0, 1}
+};
+#define NUM_SPEEDS (int) (sizeof(speeds) / sizeof(speeds[0]))
+#define DEFAULT_SPEED 1
+
+// Largest zoom level: each pair of columns shows 2^MAX_ZOOM tiles a side
+#define MAX_ZOOM 10
+
+// Lines and width of the performance overlay
+#define HUD_LINES 6
+#define HUD_WIDTH 44
+
+/*
+ * Performance overlay. Work done each frame is summed over about one
+ * second and shown as averages, so the numbers stay readable.
+ */
+typedef struct {
+    struct timespec start;
+    int frames;
+    unsigned long long steps;
+    long step_ns;
+    long render_ns;
+    unsigned long long cells_drawn;
+    // Values on display, from the last complete second
+    double steps_per_sec;
+    double step_ms;
+    double render_ms;
+    double cells_per_frame;
+#ifdef ANT_STATS
+    // Latest counters of the simulation thread, and those at the start
+    ant_stats sim;
+    ant_stats counters;
+    double chunks_per_frame;
+    double hit_rate;
+#endif
+} hud;
+
+/*
+ * Interactive session. The simulation thread owns the world and the ant
+ * and steps them; the main thread owns the terminal. The simulation
+ * thread sends a frame whenever something changed and a slot is free, and
+ * the main thread draws the newest one and sends back keys, so neither
+ * ever waits for the other.
+ */
+typedef struct {
+    grid world;
+    rule main_rule;
+    ant main_ant;
+    unsigned long long step_count;
+    char dir;
+    char *checkpoint;
+    unsigned long long checkpoint_interval;
+    char *image;
+    unsigned long long frame_interval;
+    // Corners of the rectangle every time-lapse frame covers
+    point frame_rect[2];
+    // Tiles changed since the last frame, and the view they update
+    dirty_list dirty;
+    view model;
+    channel frames;
+    channel commands;
+} session;
+
+// State of the simulation at a frame, sent to the main thread
+typedef struct {
+    view v;
+    unsigned long long step_count;
+    enum game_state state;
+    int speed;
+    int reverse;
+    // Latest notice, and the number sent so far, so each is shown once
+    char *notice;
+    unsigned int notice_count;
+    unsigned int chunk_count;
+    size_t memory;
+    // Total steps taken, forwards or backwards, and time spent taking them
+    unsigned long long steps;
+    long long step_ns;
+#ifdef ANT_STATS
+    ant_stats counters;
+#endif
+} frame;
+
+// A key for the simulation thread and the view the main thread shows
+typedef struct {
+    int key;
+    int row, col;
+    point grid_offset;
+    int zoom;
+} command;
+
 void print_usage(void)
 {
     // Print the usage message.
@@ -49,6 +192,102 @@ void print_usage(void)
         "                             U or u (up)\n"
         "                             D or d (down)\n"
         "\n"
+        "  -n <steps>               Run headless (without ncurses) for the\n"
+        "                           given number of steps, then print the\n"
+        "                           final step count, ant position and\n"
+        "                           elapsed time.\n"
+        "\n"
+        "  -b <backend>             Engine used by -n. Valid backends are:\n"
+        "                             grid (chunked grid with highway\n"
+        "                               fast-forward, default)\n"
+        "                             hashlife (memoized quadtree, for\n"
+        "                               very large step counts; runs\n"
+        "                               that gain nothing from it, or\n"
+        "                               outgrow 512 MiB, finish on the\n"
+        "                               grid)\n"
+        "\n"
+        "  -a <y,x[,dir[,pattern]]> Add an ant starting at tile (y, x),\n"
+        "                           optionally with its own direction and\n"
+        "                           pattern. May be given many times.\n"
+        "                           Requires -n.\n"
+        "\n"
+        "  -f <file>                Add the ants listed in a scenario file,\n"
+        "                           one per line in the format of -a.\n"
+        "                           Requires -n.\n"
+        "\n"
+        "  -j <threads>             Number of threads used by sweeps and to\n"
+        "                           step multiple ants (default: number\n"
+        "                           of CPUs).\n"
+        "\n"
+        "  -s <length[:alphabet]>   Sweep: run every pattern of the given\n"
+        "     or -s <file>          length over the alphabet (default LR),\n"
+        "                           or every pattern listed in a file, for\n"
+        "                           the number of steps given by -n, and\n"
+        "                           write one CSV row per pattern.\n"
+        "\n"
+        "  -m <runs>                Ensemble: run the pattern the given\n"
+        "                           number of times for the number of steps\n"
+        "                           given by -n, each from its own random\n"
+        "                           grid, on all threads, and print the\n"
+        "                           distribution of the step the ant left\n"
+        "                           the random square, the step a highway\n"
+        "                           was found and the visited tiles.\n"
+        "\n"
+        "  -g <size[:density]>      Side of the random square centered on\n"
+        "                           the ant, and the percentage of its tiles\n"
+        "                           that are not black (default: 32:50).\n"
+        "\n"
+        "  -S <seed>                Seed of the first ensemble run; run i\n"
+        "                           uses seed + i (default: 1).\n"
+        "\n"
+        "  -o <file>                Write sweep results, or the results of\n"
+        "                           every ensemble run, to a file instead\n"
+        "                           of stdout.\n"
+        "\n"
+        "  -r <file>                Resume from a snapshot file. The\n"
+        "                           pattern and direction come from the\n"
+        "                           snapshot, and -n counts the steps to\n"
+        "                           run on top of those already taken.\n"
+        "\n"
+        "  -c <file>                Snapshot file written by the 'w' key\n"
+        "                           and by -C (default: langtons_ant.snap).\n"
+        "                           With -n, it is also written at the end\n"
+        "                           of the run.\n"
+        "\n"
+        "  -C <steps>               Write the snapshot every given number\n"
+        "                           of steps.\n"
+        "\n"
+        "  -e <file>                Image written by the 'e' key, one pixel\n"
+        "                           per tile, as PNG if the name ends in\n"
+        "                           .png and PPM otherwise (default:\n"
+        "                           langtons_ant.png). With -n, it is\n"
+        "                           written at the end of the run. PNG\n"
+        "                           files are written uncompressed.\n"
+        "\n"
+        "  -E <steps>               Write a numbered image every given\n"
+        "                           number of steps, for time-lapses.\n"
+        "                           Requires -F.\n"
+        "\n"
+        "  -F <top,left,bottom,right>\n"
+        "                           Rectangle of tiles covered by every\n"
+        "                           frame of -E, corners included.\n"
+        "\n"
+        "  -t <file>                Record every move of the ant during\n"
+        "                           -n to a trajectory file.\n"
+        "\n"
+        "  -K <steps>               Steps between the keyframes of a\n"
+        "                           trajectory file (default: 16777216).\n"
+        "\n"
+        "  -T <file>                Replay a trajectory file up to the step\n"
+        "                           given by -n, or to its end if it is\n"
+        "                           shorter. The pattern and direction come\n"
+        "                           from the file.\n"
+        "\n"
+        "  -B, --back <steps>       Step the ant backwards by the given\n"
+        "                           number of steps (at most back to step\n"
+        "                           0) before showing it, or after the\n"
+        "                           steps given by -n. Most useful with -r.\n"
+        "\n"
         "  -h, --help               Display this usage message.\n"
         "\n"
         "Pattern:\n"
@@ -80,9 +319,19 @@ void print_usage(void)
         "    q          - Quit\n"
         "    p          - Pause/Resume\n"
         "    r          - Restart\n"
-        "    1          - Slow ant speed\n"
-        "    2          - Medium ant speed\n"
-        "    3          - Fast ant speed\n"
+        "    b          - Rewind/Play forward\n"
+        "    w          - Write a snapshot (see -c)\n"
+        "    e          - Export an image of the grid (see -e)\n"
+        "    i          - Show/Hide performance overlay\n"
+        "    + and -    - Zoom in and out (each pair of columns shows the\n"
+        "                 most common color of a square of tiles)\n"
+        "    1          - Slow ant speed (1 step/sec)\n"
+        "    2          - Medium ant speed (2 steps/sec)\n"
+        "    3          - Fast ant speed (10 steps/sec)\n"
+        "    4          - 10 steps per frame\n"
+        "    5          - 100 steps per frame\n"
+        "    6          - As fast as possible (the ant runs for\n"
+        "                 the whole of each frame)\n"
         "    Arrow keys - Pan around the grid\n"
         "    a          - Center ant's current location in terminal\n"
         "    c          - Center grid in terminal";
@@ -121,24 +370,967 @@ void str_toupper(char *s)
     }
 }
 
+int parse_steps(char *s, unsigned long long *steps)
+{
+    /*
+     * Parse a step count given on the command line.
+     *
+     * param s - The string to parse
+     * param steps - Pointer to the parsed step count
+     * return - 1 (true) if s is a valid non-negative integer, 0 (false) if not
+     */
+    char *end;
+
+    if (*s == '\0' || !isdigit((unsigned char) *s)) {
+        return 0;
+    }
+    errno = 0;
+    *steps = strtoull(s, &end, 10);
+    if (errno != 0 || *end != '\0') {
+        return 0;
+    }
+    return 1;
+}
+
+int parse_rect(char *s, point rect[2])
+{
+    /*
+     * Parse a rectangle given on the command line as
+     * "top,left,bottom,right".
+     *
+     * param s - The string to parse
+     * param rect - The top-left and bottom-right tiles of the rectangle
+     * return - 1 (true) if s is a valid rectangle, 0 (false) if not
+     */
+    long v[4];
+    char *end = s;
+
+    for (int i = 0; i < 4; i++) {
+        v[i] = strtol(s, &end, 10);
+        if (end == s || *end != (i < 3 ? ',' : '\0') ||
+                v[i] < -(1L << 30) || v[i] > (1L << 30)) {
+            return 0;
+        }
+        s = end + 1;
+    }
+    if (v[0] > v[2] || v[1] > v[3]) {
+        return 0;
+    }
+    set_point(&rect[0], v[0], v[1]);
+    set_point(&rect[1], v[2], v[3]);
+    return 1;
+}
+
+double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+    /*
+     * Return the number of seconds between two monotonic timestamps.
+     *
+     * param start - Pointer to the earlier timestamp
+     * param end - Pointer to the later timestamp
+     * return - Elapsed wall time in seconds
+     */
+    return (end->tv_sec - start->tv_sec) +
+        (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void sleep_until(struct timespec *deadline)
+{
+    /*
+     * Sleep until the monotonic clock reaches the given deadline.
+     *
+     * param deadline - Pointer to the absolute time to wake up at
+     */
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline,
+                NULL) == EINTR) {
+    }
+}
+
+void add_nanoseconds(struct timespec *t, long ns)
+{
+    /*
+     * Advance a timestamp by a number of nanoseconds.
+     *
+     * param t - Pointer to the timestamp to modify
+     * param ns - Nanoseconds to add, less than one second
+     */
+    t->tv_nsec += ns;
+    if (t->tv_nsec >= 1000000000L) {
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec++;
+    }
+}
+
+void init_hud(hud *h)
+{
+    /*
+     * Start a new averaging period of the performance overlay.
+     *
+     * param h - Overlay to reset
+     */
+    clock_gettime(CLOCK_MONOTONIC, &h->start);
+    h->frames = 0;
+    h->steps = 0;
+    h->step_ns = 0;
+    h->render_ns = 0;
+    h->cells_drawn = 0;
+#ifdef ANT_STATS
+    h->counters = h->sim;
+#endif
+}
+
+int update_hud(hud *h)
+{
+    /*
+     * Count one frame and, once a second has passed, work out the values
+     * to display.
+     *
+     * param h - Overlay to update
+     * return - 1 (true) if the displayed values changed, 0 (false) if not
+     */
+    struct timespec now;
+    double seconds;
+
+    h->frames++;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    seconds = elapsed_seconds(&h->start, &now);
+    if (seconds < 1) {
+        return 0;
+    }
+    h->steps_per_sec = h->steps / seconds;
+    h->step_ms = h->step_ns / 1e6 / h->frames;
+    h->render_ms = h->render_ns / 1e6 / h->frames;
+    h->cells_per_frame = (double) h->cells_drawn / h->frames;
+#ifdef ANT_STATS
+    {
+        unsigned long long lookups =
+            h->sim.chunk_lookups - h->counters.chunk_lookups;
+
+        h->chunks_per_frame = (double) (h->sim.chunks_allocated -
+                h->counters.chunks_allocated) / h->frames;
+        h->hit_rate = lookups == 0 ? 100 : 100.0 *
+            (h->sim.chunk_cache_hits - h->counters.chunk_cache_hits) /
+            lookups;
+    }
+#endif
+    init_hud(h);
+    return 1;
+}
+
+void render_hud(hud *h, frame *f, int row, int col)
+{
+    /*
+     * Draw the performance overlay in the top left corner of the terminal.
+     *
+     * param h - Overlay to draw
+     * param f - Latest frame, whose grid memory use is shown
+     * param row - Number of rows (lines) in the terminal
+     * param col - Number of columns in the terminal
+     */
+    char lines[HUD_LINES][HUD_WIDTH + 1];
+    int width = col < HUD_WIDTH ? col : HUD_WIDTH;
+    int n = 0;
+
+    snprintf(lines[n++], sizeof(lines[0]), " Steps/sec: %.0f",
+            h->steps_per_sec);
+    snprintf(lines[n++], sizeof(lines[0]),
+            " Per frame: step %.2f ms, render %.2f ms", h->step_ms,
+            h->render_ms);
+    snprintf(lines[n++], sizeof(lines[0]), " Grid: %zu KiB in %u chunks",
+            f->memory / 1024, f->chunk_count);
+    snprintf(lines[n++], sizeof(lines[0]), " Per frame: %.0f cells drawn",
+            h->cells_per_frame);
+#ifdef ANT_STATS
+    snprintf(lines[n++], sizeof(lines[0]),
+            " Per frame: %.1f new chunks", h->chunks_per_frame);
+    snprintf(lines[n++], sizeof(lines[0]), " Chunk cache hits: %.1f%%",
+            h->hit_rate);
+#else
+    snprintf(lines[n++], sizeof(lines[0]),
+            " Counters: build with make STATS=1");
+#endif
+    // The last line is reserved for the status bar
+    for (int i = 0; i < n && i < row - 1; i++) {
+        attron(A_REVERSE);
+        mvprintw(i, 0, "%-*.*s", width, width, lines[i]);
+        attroff(A_REVERSE);
+    }
+}
+
+int write_frame(char *image, grid *g, point rect[2],
+        unsigned long long frame)
+{
+    /*
+     * Export one numbered time-lapse frame of the grid. Every frame covers
+     * the same rectangle, so the frames of a run line up.
+     *
+     * param image - Image path the frame number is added to
+     * param g - Grid to export
+     * param rect - Top-left and bottom-right tiles of the frame
+     * param frame - Frame number
+     * return - 0 on success, -1 if the image could not be written
+     */
+    char path[PATH_MAX];
+
+    if (format_frame_path(path, sizeof(path), image, frame) != 0) {
+        return -1;
+    }
+    return export_image(path, g, &rect[0], &rect[1]);
+}
+
+int run_headless(char *dir, char *pattern, unsigned long long steps,
+        enum backend engine, char *resume, char *checkpoint,
+        unsigned long long interval, char *image,
+        unsigned long long frame_interval, point frame_rect[2],
+        unsigned long long back, char *trace,
+        unsigned long long keyframe_interval, char *replay)
+{
+    /*
+     * Advance the ant for a fixed number of steps without ncurses and
+     * print a summary of the run to stdout.
+     *
+     * param dir - Ant's starting direction
+     * param pattern - String pattern that determines the ant's behavior
+     * param steps - Number of steps to run
+     * param engine - Backend used to advance the ant
+     * param resume - Snapshot to start from, or NULL to start at step 0
+     * param checkpoint - Snapshot written at the end of the run and every
+     *   interval steps, or NULL
+     * param interval - Steps between snapshots, or 0 for none
+     * param image - Image written at the end of the run and, numbered,
+     *   every frame_interval steps, or NULL
+     * param frame_interval - Steps between numbered images, or 0 for none
+     * param frame_rect - Top-left and bottom-right tiles of the numbered
+     *   images
+     * param back - Steps to undo after running forward
+     * param trace - Trajectory file recording the steps run forward, or
+     *   NULL
+     * param keyframe_interval - Steps between the keyframes of trace
+     * param replay - Trajectory file to replay up to step steps instead of
+     *   running the ant, or NULL
+     * return - Exit status for main (0 on success, 1 if the world ran out
+     *   of memory before completing all steps or a snapshot or image
+     *   could not be read or written)
+     */
+    unsigned long long step_count = 0;
+    unsigned long long start_count, end_count, taken;
+    struct timespec start, end;
+    double elapsed;
+    int out_of_memory = 0;
+    int save_failed = 0;
+    int export_failed = 0;
+    int trace_failed = 0;
+    char start_dir = dir[0];
+    grid world;
+    hl_world hl;
+    rule main_rule;
+    highway hw;
+    ant main_ant;
+    recorder *rec = NULL;
+
+    if (replay != NULL) {
+        // Replays are timed from the moment the file is opened
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (replay_trajectory(replay, steps, &world, &main_ant, &main_rule,
+                &start_dir, &step_count) != 0) {
+            printf("Could not replay trajectory %s\n", replay);
+            return 1;
+        }
+        init_highway(&hw);
+        steps = 0;
+    } else if (resume != NULL) {
+        if (load_snapshot(resume, &world, &main_ant, &main_rule, &start_dir,
+                &step_count) != 0) {
+            printf("Could not load snapshot %s\n", resume);
+            return 1;
+        }
+        init_highway(&hw);
+        // Start searching for a highway from the resumed step
+        hw.next_check = step_count + CHECK_INTERVAL;
+    } else {
+        set_point(&main_ant.pos, 0, 0);
+        set_ant_dir(&main_ant, dir[0]);
+        compile_rule(&main_rule, pattern);
+        if (engine == BACKEND_HASHLIFE) {
+            if (init_hashlife(&hl) != 0) {
+                printf("Out of memory\n");
+                return 1;
+            }
+        } else {
+            init_grid(&world, choose_tile_bits(main_rule.colors));
+            init_highway(&hw);
+        }
+    }
+    if (trace != NULL && ((rec = malloc(sizeof(recorder))) == NULL ||
+                open_recorder(rec, trace, &world, &main_ant, &main_rule,
+                    start_dir, step_count, keyframe_interval) != 0)) {
+        printf("Could not write trajectory %s\n", trace);
+        free(rec);
+        free_grid(&world);
+        return 1;
+    }
+    // Every step a replay rebuilt counts as taken
+    start_count = replay != NULL ? 0 : step_count;
+    end_count = steps > ULLONG_MAX - step_count ? ULLONG_MAX :
+        step_count + steps;
+
+    if (replay == NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+    if (engine == BACKEND_HASHLIFE) {
+        int status = advance_hashlife(&hl, &main_ant, &main_rule,
+                &step_count, steps);
+
+        if (status > 0) {
+            // Memoization stopped paying off; finish the run on the grid
+            printf("Hashlife: no gain from memoization at step %llu (%zu "
+                    "KiB, %d collections), continuing on the grid\n",
+                    step_count, hl.memory / 1024, hl.collections);
+            init_grid(&world, choose_tile_bits(main_rule.colors));
+            init_highway(&hw);
+            hw.next_check = step_count + CHECK_INTERVAL;
+            out_of_memory = copy_hashlife(&hl, &world) != 0;
+            free_hashlife(&hl);
+            engine = BACKEND_GRID;
+        } else {
+            out_of_memory = status != 0;
+        }
+    }
+    if (engine == BACKEND_GRID && !out_of_memory) {
+        plan_final_check(&hw, step_count, end_count);
+        // Stop at every checkpoint and frame on the way to the last step
+        while (step_count < end_count && !out_of_memory) {
+            unsigned long long n = end_count - step_count;
+
+            if (interval > 0 && n > interval - step_count % interval) {
+                n = interval - step_count % interval;
+            }
+            if (frame_interval > 0 &&
+                    n > frame_interval - step_count % frame_interval) {
+                n = frame_interval - step_count % frame_interval;
+            }
+            if (rec != NULL) {
+                out_of_memory = record_steps(rec, &world, &main_ant,
+                        &main_rule, &step_count, n) != 0;
+            } else {
+                out_of_memory = advance_ant(&world, &main_ant, &main_rule,
+                        &hw, &step_count, n) != 0;
+            }
+            if (out_of_memory) {
+                break;
+            }
+            if (interval > 0 && step_count % interval == 0 &&
+                    step_count < end_count && save_snapshot(checkpoint,
+                        &world, &main_ant, &main_rule, start_dir,
+                        step_count) != 0) {
+                save_failed = 1;
+                break;
+            }
+            if (frame_interval > 0 && step_count % frame_interval == 0 &&
+                    write_frame(image, &world, frame_rect,
+                        step_count / frame_interval) != 0) {
+                export_failed = 1;
+                break;
+            }
+        }
+    }
+    if (rec != NULL) {
+        trace_failed = close_recorder(rec) != 0;
+        free(rec);
+    }
+    taken = step_count - start_count;
+    // Step back from wherever the run ended, stopping at step 0
+    for (; back > 0 && step_count > 0 && !out_of_memory && !save_failed &&
+            !export_failed; back--) {
+        if (unstep_grid(&world, &main_ant, &main_rule) != 0) {
+            out_of_memory = 1;
+            break;
+        }
+        step_count--;
+        taken++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = elapsed_seconds(&start, &end);
+    if (checkpoint != NULL && !save_failed && save_snapshot(checkpoint,
+                &world, &main_ant, &main_rule, start_dir, step_count) != 0) {
+        save_failed = 1;
+    }
+    if (image != NULL && !export_failed &&
+            export_image(image, &world, NULL, NULL) != 0) {
+        export_failed = 1;
+    }
+
+    printf("Pattern: %c-%s\n", start_dir, main_rule.pattern);
+    printf("Step: %llu\n", step_count);
+    printf("Ant position: (%d, %d)\n", main_ant.pos.y, main_ant.pos.x);
+    if (engine == BACKEND_HASHLIFE) {
+        printf("Nodes: %zu, memoized walks: %zu (%zu KiB)\n",
+                hl.node_count, hl.memo_count, hl.memory / 1024);
+        free_hashlife(&hl);
+    } else {
+        printf("Chunks: %u (%zu KiB, %d bit tiles)\n", world.chunk_count,
+                grid_memory(&world) / 1024, world.tile_bits);
+        // Replays apply the recorded turns without looking for highways
+        if (hw.state == HIGHWAY_FOUND) {
+            printf("Highway: period %d, displacement (%d, %d), "
+                    "confirmed at step %llu\n", hw.period,
+                    hw.displacement.y, hw.displacement.x, hw.base_step);
+        } else if (replay == NULL) {
+            printf("Highway: none\n");
+        }
+        free_grid(&world);
+    }
+    printf("Elapsed: %.6f s\n", elapsed);
+    if (elapsed > 0) {
+        printf("Steps/sec: %.0f\n", taken / elapsed);
+    }
+    if (out_of_memory) {
+        printf("Out of memory\n");
+        return 1;
+    }
+    if (save_failed) {
+        printf("Could not write snapshot %s\n", checkpoint);
+        return 1;
+    }
+    if (export_failed) {
+        printf("Could not write image %s\n", image);
+        return 1;
+    }
+    if (trace_failed) {
+        printf("Could not write trajectory %s\n", trace);
+        return 1;
+    }
+    return 0;
+}
+
+int run_colony_headless(colony *c, unsigned long long steps, int threads)
+{
+    /*
+     * Advance a colony of ants for a fixed number of generations without
+     * ncurses and print a summary of the run to stdout.
+     *
+     * param c - Colony holding the ants to run, freed afterwards
+     * param steps - Number of generations to run
+     * param threads - Number of worker threads
+     * return - Exit status for main (0 on success, 1 on failure)
+     */
+    struct timespec start, end;
+    double elapsed;
+    int failed;
+
+    if (start_colony(c, threads) != 0) {
+        free_colony(c);
+        printf("Out of memory\n");
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    failed = run_colony(c, steps) != 0;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = elapsed_seconds(&start, &end);
+
+    printf("Ants: %d (%d patterns, %d threads)\n", c->ant_count,
+            c->rule_count, c->thread_count);
+    printf("Step: %llu\n", c->generation);
+    for (int i = 0; i < c->ant_count && i < 8; i++) {
+        printf("Ant %d position: (%d, %d)\n", i, c->ants[i].pos.y,
+                c->ants[i].pos.x);
+    }
+    printf("Memory: %zu KiB\n", colony_memory(c) / 1024);
+    printf("Elapsed: %.6f s\n", elapsed);
+    if (elapsed > 0) {
+        printf("Ant steps/sec: %.0f\n",
+                (double) c->generation * c->ant_count / elapsed);
+    }
+    free_colony(c);
+    if (failed) {
+        printf("Out of memory\n");
+        return 1;
+    }
+    return 0;
+}
+
+int run_sweep_headless(char *spec, char *output, unsigned long long steps,
+        char dir, int threads)
+{
+    /*
+     * Run a sweep over many patterns and write its results as CSV.
+     *
+     * param spec - "<length>[:<alphabet>]" or the path of a pattern file
+     * param output - Path of the CSV file, or NULL for stdout
+     * param steps - Number of steps to run each pattern for
+     * param dir - Starting direction of the ant
+     * param threads - Number of worker threads
+     * return - Exit status for main (0 on success, 1 on failure)
+     */
+    struct timespec start, end;
+    char alphabet[5] = "LR";
+    char *end_ptr;
+    long length = strtol(spec, &end_ptr, 10);
+    FILE *out = stdout;
+    sweep s;
+    int status;
+
+    init_sweep(&s);
+    if (end_ptr != spec && (*end_ptr == '\0' || *end_ptr == ':')) {
+        if (*end_ptr == ':') {
+            if (strlen(end_ptr + 1) >= sizeof(alphabet)) {
+                printf("Invalid sweep alphabet "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            strcpy(alphabet, end_ptr + 1);
+        }
+        for (char *c = alphabet; *c != '\0'; c++) {
+            *c = toupper((unsigned char) *c);
+            if (strchr("LRUN", *c) == NULL || strchr(c + 1, *c) != NULL) {
+                printf("Invalid sweep alphabet "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+        }
+        if (length < 2 || length > MAX_COLORS || strlen(alphabet) < 1 ||
+                enumerate_patterns(&s, length, alphabet) != 0) {
+            printf("Invalid sweep length "
+                    "(\"langtons_ant --help\" for help)\n");
+            free_sweep(&s);
+            return 1;
+        }
+    } else if ((status = load_patterns(&s, spec)) != 0) {
+        if (status < 0) {
+            printf("Could not read pattern file %s\n", spec);
+        } else {
+            printf("Invalid pattern on line %d of %s\n", status, spec);
+        }
+        free_sweep(&s);
+        return 1;
+    }
+    if (output != NULL && (out = fopen(output, "w")) == NULL) {
+        printf("Could not write %s\n", output);
+        free_sweep(&s);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    status = run_sweep(&s, steps, dir, threads);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (status == 0) {
+        write_sweep_csv(&s, out);
+        fprintf(stderr, "Swept %d patterns x %llu steps in %.3f s "
+                "(%d threads)\n", s.pattern_count, steps,
+                elapsed_seconds(&start, &end), threads);
+    } else {
+        fprintf(stderr, "Out of memory\n");
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+    free_sweep(&s);
+    return status != 0;
+}
+
+int run_ensemble_headless(char *pattern, char dir, int runs, char *fill,
+        unsigned long long seed, char *output, unsigned long long steps,
+        int threads)
+{
+    /*
+     * Run an ensemble of a pattern from random grids and print the
+     * distribution of its results.
+     *
+     * param pattern - String pattern that determines the ant's behavior
+     * param dir - Starting direction of the ant
+     * param runs - Number of runs
+     * param fill - "<size>[:<density>]" of the random square, or NULL for
+     *   the default
+     * param seed - Seed of the first run
+     * param output - Path of a CSV file for the result of every run, or
+     *   NULL for none
+     * param steps - Number of steps to run each time
+     * param threads - Number of worker threads
+     * return - Exit status for main (0 on success, 1 on failure)
+     */
+    struct timespec start, end;
+    double elapsed;
+    FILE *out = NULL;
+    ensemble e;
+    int status;
+
+    init_ensemble(&e, pattern, dir);
+    e.seed = seed;
+    if (fill != NULL && parse_fill(&e, fill) != 0) {
+        printf("Invalid random grid "
+                "(\"langtons_ant --help\" for help)\n");
+        return 1;
+    }
+    if (output != NULL && (out = fopen(output, "w")) == NULL) {
+        printf("Could not write %s\n", output);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    status = run_ensemble(&e, runs, steps, threads);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = elapsed_seconds(&start, &end);
+    if (status == 0) {
+        printf("Pattern: %c-%s\n", dir, e.r.pattern);
+        printf("Runs: %d x %llu steps (%dx%d random tiles at %d%%, "
+                "seed %llu)\n", runs, steps, e.size, e.size, e.density,
+                seed);
+        status = write_ensemble_summary(&e, stdout);
+        printf("Elapsed: %.6f s (%d threads)\n", elapsed, threads);
+        if (out != NULL) {
+            write_ensemble_csv(&e, out);
+        }
+    }
+    if (status != 0) {
+        printf("Out of memory\n");
+    }
+    if (out != NULL) {
+        fclose(out);
+    }
+    free_ensemble(&e);
+    return status != 0;
+}
+
+int send_command(channel *commands, int key, int row, int col,
+        point *grid_offset, int zoom)
+{
+    /*
+     * Send a key and the view the terminal shows to the simulation thread.
+     *
+     * param commands - Channel to the simulation thread
+     * param key - Key pressed, or 0 if only the view changed
+     * param row - Number of rows (lines) in the terminal
+     * param col - Number of columns in the terminal
+     * param grid_offset - Pointer to the grid offset
+     * param zoom - log2 of the number of tiles on a side of a drawn block
+     * return - 0 on success, -1 if the channel is full
+     */
+    command *c = get_send_slot(commands);
+
+    if (c == NULL) {
+        return -1;
+    }
+    c->key = key;
+    c->row = row;
+    c->col = col;
+    c->grid_offset = *grid_offset;
+    c->zoom = zoom;
+    send_slot(commands);
+    return 0;
+}
+
+int step_session(session *s, unsigned long long n, int reverse)
+{
+    /*
+     * Step the ant forwards or backwards, keeping track of the tiles that
+     * change for the next frame.
+     *
+     * param s - Session whose ant to step
+     * param n - Number of steps
+     * param reverse - 1 (true) to step backwards
+     * return - 0 on success, 1 if rewinding reached step 0 first, -1 if
+     *   memory could not be allocated
+     */
+    if (!reverse && n > DIRTY_CAPACITY) {
+        // Too many tiles change to list; capture the whole view
+        s->dirty.full_redraw = 1;
+        return step_grid(&s->world, &s->main_ant, &s->main_rule,
+                &s->step_count, n);
+    }
+    for (unsigned long long i = 0; i < n; i++) {
+        if (reverse && s->step_count == 0) {
+            return 1;
+        }
+        // The tile under the ant is about to change color
+        mark_dirty(&s->dirty, &s->main_ant.pos);
+        if (reverse) {
+            if (unstep_grid(&s->world, &s->main_ant, &s->main_rule) != 0) {
+                return -1;
+            }
+            // The ant steps back onto a tile that changes color
+            mark_dirty(&s->dirty, &s->main_ant.pos);
+            s->step_count--;
+        } else {
+            if (update_grid(&s->world, &s->main_ant, &s->main_rule) != 0) {
+                return -1;
+            }
+            s->step_count++;
+        }
+    }
+    return 0;
+}
+
+void *run_simulation(void *arg)
+{
+    /*
+     * Simulation thread entry point: step the ant at the chosen speed,
+     * write snapshots and images, and send frames to the main thread until
+     * it sends 'q'.
+     *
+     * param arg - Pointer to the session
+     * return - NULL
+     */
+    session *s = arg;
+    enum game_state state = RUNNING;
+    int speed = DEFAULT_SPEED;
+    int frame_count = 0;
+    int reverse = 0;
+    int quit = 0;
+    int changed = 1;
+    unsigned long long step_budget = 1;
+    unsigned long long next_checkpoint = s->checkpoint_interval > 0 ?
+        (s->step_count / s->checkpoint_interval + 1) *
+        s->checkpoint_interval : ULLONG_MAX;
+    unsigned long long next_frame = s->frame_interval > 0 ?
+        (s->step_count / s->frame_interval + 1) * s->frame_interval :
+        ULLONG_MAX;
+    char *notice = NULL;
+    unsigned int notice_count = 0;
+    unsigned long long steps = 0;
+    long long step_ns = 0;
+    struct timespec deadline, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    while (!quit) {
+        int save = 0;
+        int export = 0;
+        int reset = 0;
+        char *set_notice = NULL;
+        command *c;
+        frame *f;
+
+        add_nanoseconds(&deadline, FRAME_NS);
+        // Handle every command sent since the last frame
+        while ((c = get_receive_slot(&s->commands)) != NULL) {
+            command cmd = *c;
+
+            receive_slot(&s->commands);
+            changed = 1;
+            if (cmd.row != s->model.row || cmd.col != s->model.col ||
+                    cmd.zoom != s->model.zoom ||
+                    cmd.grid_offset.y != s->model.grid_offset.y ||
+                    cmd.grid_offset.x != s->model.grid_offset.x) {
+                // Pan, resize and zoom capture every visible tile
+                s->model.row = cmd.row;
+                s->model.col = cmd.col;
+                s->model.zoom = cmd.zoom;
+                s->model.grid_offset = cmd.grid_offset;
+                s->dirty.full_redraw = 1;
+            }
+            if (cmd.key == 'q') {
+                quit = 1;
+            } else if (cmd.key == 'w') {
+                save = 1;
+            } else if (cmd.key == 'e') {
+                export = 1;
+            } else if (state == RUNNING) {
+                // Check these only when running
+                if (cmd.key == 'p') {
+                    state = PAUSED;
+                } else if (cmd.key == 'r') {
+                    reset = 1;
+                } else if (cmd.key == 'b') {
+                    reverse = !reverse;
+                } else {
+                    for (int i = 0; i < NUM_SPEEDS; i++) {
+                        if (cmd.key == speeds[i].key) {
+                            speed = i;
+                            frame_count = 0;
+                            step_budget = 1;
+                        }
+                    }
+                }
+            } else if (state == PAUSED) {
+                // Check these only when paused
+                if (cmd.key == 'p') {
+                    state = RUNNING;
+                }
+            } else if (state == GAME_OVER) {
+                // Check these only when game over
+                if (cmd.key == 'r') {
+                    reset = 1;
+                }
+            }
+        }
+        if (quit) {
+            break;
+        }
+
+        // Advance the ant once every speeds[speed].frames frames
+        if (state == RUNNING && ++frame_count >= speeds[speed].frames) {
+            struct timespec start, end;
+
+            frame_count = 0;
+            changed = 1;
+            do {
+                unsigned long long n = speeds[speed].steps > 0 ?
+                    speeds[speed].steps : step_budget;
+                unsigned long long before = s->step_count;
+                long elapsed_ns;
+                int status;
+
+                // Stop at the next checkpoint or frame to write it on time
+                if (!reverse && n > next_checkpoint - s->step_count) {
+                    n = next_checkpoint - s->step_count;
+                }
+                if (!reverse && n > next_frame - s->step_count) {
+                    n = next_frame - s->step_count;
+                }
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                status = step_session(s, n, reverse);
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                elapsed_ns = elapsed_seconds(&start, &end) * 1e9;
+                step_ns += elapsed_ns;
+                steps += s->step_count > before ? s->step_count - before :
+                    before - s->step_count;
+                // At full speed, size batches to take about STEP_SLICE_NS
+                if (elapsed_ns > STEP_SLICE_NS) {
+                    step_budget = n * STEP_SLICE_NS / elapsed_ns;
+                    step_budget = step_budget > 0 ? step_budget : 1;
+                } else if (n == step_budget) {
+                    step_budget = n * 2;
+                }
+                if (status < 0) {
+                    // Grid could not allocate memory for a new chunk
+                    state = GAME_OVER;
+                } else if (status > 0) {
+                    // Nothing left to rewind
+                    reverse = 0;
+                    state = PAUSED;
+                }
+                if (!reverse && s->step_count == next_checkpoint) {
+                    next_checkpoint += s->checkpoint_interval;
+                    save = 1;
+                }
+                if (!reverse && s->step_count == next_frame) {
+                    if (write_frame(s->image, &s->world, s->frame_rect,
+                            s->step_count / s->frame_interval) != 0) {
+                        set_notice = "Export failed";
+                    }
+                    next_frame += s->frame_interval;
+                }
+            } while (speeds[speed].steps == 0 && state == RUNNING && !save &&
+                    elapsed_seconds(&end, &deadline) > 0);
+        }
+
+        // Check flags
+        if (save) {
+            set_notice = save_snapshot(s->checkpoint, &s->world,
+                    &s->main_ant, &s->main_rule, s->dir,
+                    s->step_count) == 0 ?
+                "Snapshot written" : "Snapshot failed";
+        }
+        if (export) {
+            set_notice = export_image(s->image, &s->world, NULL,
+                    NULL) == 0 ?
+                "Image written" : "Export failed";
+        }
+        if (set_notice != NULL) {
+            notice = set_notice;
+            notice_count++;
+            changed = 1;
+        }
+        if (reset) {
+            speed = DEFAULT_SPEED;
+            frame_count = 0;
+            step_budget = 1;
+            set_point(&s->main_ant.pos, 0, 0);
+            set_ant_dir(&s->main_ant, s->dir);
+            reset_grid(&s->world);
+            s->step_count = 0;
+            reverse = 0;
+            next_checkpoint = s->checkpoint_interval > 0 ?
+                s->checkpoint_interval : ULLONG_MAX;
+            next_frame = s->frame_interval > 0 ? s->frame_interval :
+                ULLONG_MAX;
+            state = RUNNING;
+            s->dirty.full_redraw = 1;
+        }
+
+        // Send a frame if anything changed and a slot is free
+        if (changed && (f = get_send_slot(&s->frames)) != NULL) {
+            if (capture_view(&s->model, &s->world, &s->main_ant,
+                        &s->dirty) != 0 || copy_view(&f->v, &s->model) != 0) {
+                state = GAME_OVER;
+            }
+            f->step_count = s->step_count;
+            f->state = state;
+            f->speed = speed;
+            f->reverse = reverse;
+            f->notice = notice;
+            f->notice_count = notice_count;
+            f->chunk_count = s->world.chunk_count;
+            f->memory = grid_memory(&s->world);
+            f->steps = steps;
+            f->step_ns = step_ns;
+#ifdef ANT_STATS
+            f->counters = stats;
+#endif
+            send_slot(&s->frames);
+            changed = 0;
+        }
+
+        // Wait for the next frame, skipping ahead if we fell behind
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (elapsed_seconds(&deadline, &now) > 0) {
+            deadline = now;
+        }
+        sleep_until(&deadline);
+    }
+    return NULL;
+}
+
 int main(int argc, char *argv[])
 {
-    enum game_state state;
     int row, col, ch, step_col;
-    unsigned int step_count;
+    int quit;
+    struct timespec frame_deadline, now;
     char *quit_msg;
     char *paused_msg;
-    char pattern[17];
-    char dir[2];
-    int grid[GRID_SIZE_Y][GRID_SIZE_X] = {{0}};
+    char pattern[17] = "";
+    char dir[2] = "";
+    int headless = 0;
+    enum backend engine = BACKEND_GRID;
+    int engine_set = 0;
+    unsigned long long headless_steps = 0;
+    char **ant_specs = NULL;
+    int ant_spec_count = 0;
+    char *scenario = NULL;
+    int threads = 0;
+    char *sweep_spec = NULL;
+    char *output = NULL;
+    unsigned long long runs = 0;
+    char *fill = NULL;
+    unsigned long long seed = 1;
+    int seed_set = 0;
+    char *resume = NULL;
+    char *trace = NULL;
+    unsigned long long keyframe_interval = 0;
+    char *replay = NULL;
+    char *checkpoint = NULL;
+    unsigned long long checkpoint_interval = 0;
+    char *image = NULL;
+    unsigned long long frame_interval = 0;
+    point frame_rect[2] = {{0, 0}, {0, 0}};
+    int frame_rect_set = 0;
+    unsigned long long back = 0;
+    int back_set = 0;
+    int show_hud = 0;
+    int redraw_all = 0;
+    int zoom = 0;
+    char zoom_label[16] = "";
+    hud perf;
+    char *notice = NULL;
+    int notice_frames = 0;
+    colony ants;
+    session sim;
+    pthread_t sim_thread;
+    frame current;
+    view shown;
     point grid_offset = {0, 0};
-    ant main_ant;
 
     // Parse arguments
-    if (argc > 4) {
-        printf("Too many arguments (\"langtons_ant --help\" for help)\n");
-        return 1;
-    } else if (argc == 2 && (strcmp(argv[1], "-h") == 0 ||
+    if (argc == 2 && (strcmp(argv[1], "-h") == 0 ||
             strcmp(argv[1], "--help") == 0)) {
         print_usage();
         return 0;
@@ -164,6 +1356,134 @@ int main(int argc, char *argv[])
             strcpy(dir, argv[i + 1]);
             str_toupper(dir);
             i++;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            if (headless) {
+                printf("Invalid arguments "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            if (i == argc - 1 || !parse_steps(argv[i + 1], &headless_steps)) {
+                printf("Invalid step count "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            headless = 1;
+            i++;
+        } else if (strcmp(argv[i], "-b") == 0) {
+            if (engine_set || i == argc - 1) {
+                printf("Invalid arguments "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            if (strcmp(argv[i + 1], "grid") == 0) {
+                engine = BACKEND_GRID;
+            } else if (strcmp(argv[i + 1], "hashlife") == 0) {
+                engine = BACKEND_HASHLIFE;
+            } else {
+                printf("Invalid backend "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            engine_set = 1;
+            i++;
+        } else if (strcmp(argv[i], "-a") == 0) {
+            if (i == argc - 1) {
+                printf("Invalid ant "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            if (ant_specs == NULL &&
+                    (ant_specs = malloc(argc * sizeof(char *))) == NULL) {
+                printf("Out of memory\n");
+                return 1;
+            }
+            ant_specs[ant_spec_count++] = argv[++i];
+        } else if (strcmp(argv[i], "-f") == 0) {
+            if (scenario != NULL || i == argc - 1) {
+                printf("Invalid arguments "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            scenario = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "-o") == 0 ||
+                strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "-c") == 0 ||
+                strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "-t") == 0 ||
+                strcmp(argv[i], "-T") == 0 || strcmp(argv[i], "-g") == 0) {
+            char **target = argv[i][1] == 's' ? &sweep_spec :
+                argv[i][1] == 'o' ? &output :
+                argv[i][1] == 'r' ? &resume :
+                argv[i][1] == 'c' ? &checkpoint :
+                argv[i][1] == 't' ? &trace :
+                argv[i][1] == 'T' ? &replay :
+                argv[i][1] == 'g' ? &fill : &image;
+
+            if (*target != NULL || i == argc - 1) {
+                printf("Invalid arguments "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            *target = argv[++i];
+        } else if (strcmp(argv[i], "-C") == 0 || strcmp(argv[i], "-E") == 0 ||
+                strcmp(argv[i], "-K") == 0) {
+            unsigned long long *target = argv[i][1] == 'C' ?
+                &checkpoint_interval : argv[i][1] == 'E' ?
+                &frame_interval : &keyframe_interval;
+
+            if (*target > 0 || i == argc - 1 ||
+                    !parse_steps(argv[i + 1], target) || *target == 0) {
+                printf("Invalid interval "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "-F") == 0) {
+            if (frame_rect_set || i == argc - 1 ||
+                    !parse_rect(argv[i + 1], frame_rect)) {
+                printf("Invalid rectangle "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            frame_rect_set = 1;
+            i++;
+        } else if (strcmp(argv[i], "-B") == 0 ||
+                strcmp(argv[i], "--back") == 0) {
+            if (back_set || i == argc - 1 ||
+                    !parse_steps(argv[i + 1], &back)) {
+                printf("Invalid step count "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            back_set = 1;
+            i++;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            if (runs > 0 || i == argc - 1 ||
+                    !parse_steps(argv[i + 1], &runs) || runs < 1 ||
+                    runs > MAX_ENSEMBLE_RUNS) {
+                printf("Invalid run count "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "-S") == 0) {
+            if (seed_set || i == argc - 1 ||
+                    !parse_steps(argv[i + 1], &seed)) {
+                printf("Invalid seed "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            seed_set = 1;
+            i++;
+        } else if (strcmp(argv[i], "-j") == 0) {
+            unsigned long long n;
+
+            if (i == argc - 1 || !parse_steps(argv[i + 1], &n) || n < 1 ||
+                    n > 1024) {
+                printf("Invalid thread count "
+                        "(\"langtons_ant --help\" for help)\n");
+                return 1;
+            }
+            threads = n;
+            i++;
         } else {
             if (pattern[0] != '\0') {
                 printf("Invalid arguments "
@@ -171,36 +1491,185 @@ int main(int argc, char *argv[])
                 return 1;
             }
             char *s = argv[i];
-            if (strlen(s) < 2 || strlen(s) > MAX_COLORS) {
+            if (!is_valid_pattern(s)) {
                 printf("Invalid pattern "
                         "(\"langtons_ant --help\" for help)\n");
                 return 1;
             }
-            for (int i = 0; i < strlen(s); i++) {
-                if (s[i] != 'R' && s[i] != 'r' &&
-                        s[i] != 'L' && s[i] != 'l' &&
-                        s[i] != 'U' && s[i] != 'u' &&
-                        s[i] != 'N' && s[i] != 'n') {
-                    printf("Invalid pattern "
-                            "(\"langtons_ant --help\" for help)\n");
-                    return 1;
-                }
-            }
             strcpy(pattern, s);
             str_toupper(pattern);
         }
     }
+    if (resume != NULL || checkpoint != NULL || checkpoint_interval > 0 ||
+            image != NULL || frame_interval > 0 || back_set ||
+            trace != NULL || keyframe_interval > 0 || replay != NULL) {
+        // These work on one ant on the chunked grid
+        if ((resume != NULL && (dir[0] != '\0' || pattern[0] != '\0')) ||
+                engine == BACKEND_HASHLIFE || sweep_spec != NULL ||
+                runs > 0 || ant_spec_count > 0 || scenario != NULL) {
+            printf("Invalid arguments "
+                    "(\"langtons_ant --help\" for help)\n");
+            free(ant_specs);
+            return 1;
+        }
+        // Recording and replay only run headless
+        if (((trace != NULL || keyframe_interval > 0 || replay != NULL) &&
+                    !headless) || (keyframe_interval > 0 && trace == NULL) ||
+                (replay != NULL && (dir[0] != '\0' || pattern[0] != '\0' ||
+                    resume != NULL || trace != NULL ||
+                    checkpoint_interval > 0 || frame_interval > 0))) {
+            printf("Invalid arguments "
+                    "(\"langtons_ant --help\" for help)\n");
+            free(ant_specs);
+            return 1;
+        }
+    }
+    // Time-lapse frames all cover the rectangle given by -F
+    if ((frame_interval > 0) != frame_rect_set) {
+        printf("Invalid arguments "
+                "(\"langtons_ant --help\" for help)\n");
+        free(ant_specs);
+        return 1;
+    }
+    // Ensembles run one ant per grid, from random tiles
+    if (((fill != NULL || seed_set) && runs == 0) || (runs > 0 &&
+                (engine == BACKEND_HASHLIFE || sweep_spec != NULL ||
+                 ant_spec_count > 0 || scenario != NULL))) {
+        printf("Invalid arguments "
+                "(\"langtons_ant --help\" for help)\n");
+        free(ant_specs);
+        return 1;
+    }
+    if (keyframe_interval == 0) {
+        keyframe_interval = DEFAULT_KEYFRAME_INTERVAL;
+    }
+    if (checkpoint == NULL && (checkpoint_interval > 0 || !headless)) {
+        checkpoint = DEFAULT_SNAPSHOT;
+    }
+    if (image == NULL && (frame_interval > 0 || !headless)) {
+        image = DEFAULT_IMAGE;
+    }
     if (dir[0] == '\0') {
         strcpy(dir, "L");
     }
     if (pattern[0] == '\0') {
         strcpy(pattern, "RL");
     }
+    if (threads == 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = threads > 0 ? threads : 1;
+    }
+    if (runs > 0) {
+        free(ant_specs);
+        if (!headless) {
+            printf("Ensembles require -n "
+                    "(\"langtons_ant --help\" for help)\n");
+            return 1;
+        }
+        return run_ensemble_headless(pattern, dir[0], runs, fill, seed,
+                output, headless_steps, threads);
+    }
+    if (sweep_spec != NULL) {
+        if (!headless) {
+            printf("Sweeps require -n "
+                    "(\"langtons_ant --help\" for help)\n");
+            free(ant_specs);
+            return 1;
+        }
+        free(ant_specs);
+        return run_sweep_headless(sweep_spec, output, headless_steps, dir[0],
+                threads);
+    }
+    if (ant_spec_count > 0 || scenario != NULL) {
+        int status;
+
+        if (!headless) {
+            printf("Multiple ants require -n "
+                    "(\"langtons_ant --help\" for help)\n");
+            free(ant_specs);
+            return 1;
+        }
+        init_colony(&ants);
+        for (int i = 0; i < ant_spec_count; i++) {
+            if (parse_ant_spec(&ants, ant_specs[i], dir[0], pattern) != 0) {
+                printf("Invalid ant \"%s\" "
+                        "(\"langtons_ant --help\" for help)\n",
+                        ant_specs[i]);
+                free(ant_specs);
+                free_colony(&ants);
+                return 1;
+            }
+        }
+        free(ant_specs);
+        if (scenario != NULL &&
+                (status = load_scenario(&ants, scenario, dir[0],
+                        pattern)) != 0) {
+            if (status < 0) {
+                printf("Could not read scenario file %s\n", scenario);
+            } else {
+                printf("Invalid ant on line %d of %s\n", status, scenario);
+            }
+            free_colony(&ants);
+            return 1;
+        }
+        return run_colony_headless(&ants, headless_steps, threads);
+    }
+    if (headless) {
+        return run_headless(dir, pattern, headless_steps, engine, resume,
+                checkpoint, checkpoint_interval, image, frame_interval,
+                frame_rect, back, trace, keyframe_interval, replay);
+    }
+
+    memset(&sim, 0, sizeof(session));
+    if (resume != NULL) {
+        if (load_snapshot(resume, &sim.world, &sim.main_ant, &sim.main_rule,
+                &dir[0], &sim.step_count) != 0) {
+            printf("Could not load snapshot %s\n", resume);
+            return 1;
+        }
+        dir[1] = '\0';
+        strcpy(pattern, sim.main_rule.pattern);
+    } else {
+        set_point(&sim.main_ant.pos, 0, 0);
+        set_ant_dir(&sim.main_ant, dir[0]);
+        compile_rule(&sim.main_rule, pattern);
+        init_grid(&sim.world, choose_tile_bits(sim.main_rule.colors));
+    }
+    for (; back > 0 && sim.step_count > 0; back--) {
+        if (unstep_grid(&sim.world, &sim.main_ant, &sim.main_rule) != 0) {
+            free_grid(&sim.world);
+            printf("Out of memory\n");
+            return 1;
+        }
+        sim.step_count--;
+    }
+    sim.dir = dir[0];
+    sim.checkpoint = checkpoint;
+    sim.checkpoint_interval = checkpoint_interval;
+    sim.image = image;
+    sim.frame_interval = frame_interval;
+    memcpy(sim.frame_rect, frame_rect, sizeof(frame_rect));
+    if (track_summary(&sim.world) != 0 ||
+            init_dirty(&sim.dirty, DIRTY_CAPACITY) != 0 ||
+            init_channel(&sim.frames, FRAME_SLOTS, sizeof(frame)) != 0 ||
+            init_channel(&sim.commands, COMMAND_SLOTS,
+                sizeof(command)) != 0) {
+        free_grid(&sim.world);
+        free_dirty(&sim.dirty);
+        free_channel(&sim.frames);
+        free_channel(&sim.commands);
+        printf("Out of memory\n");
+        return 1;
+    }
 
     // Initiate ncurses
     initscr();
     if (has_colors() == FALSE) {
         endwin();
+        free_grid(&sim.world);
+        free_dirty(&sim.dirty);
+        free_channel(&sim.frames);
+        free_channel(&sim.commands);
         printf("Terminal does not support color\n");
         return 1;
     }
@@ -217,6 +1686,7 @@ int main(int argc, char *argv[])
 
     noecho();
     keypad(stdscr, TRUE);
+    nodelay(stdscr, TRUE);
     curs_set(0);
 
     quit_msg = "Press 'q' to quit";
@@ -226,117 +1696,186 @@ int main(int argc, char *argv[])
 
     clear();
     update_offset(&grid_offset, ZERO);
-    halfdelay(5);
-    set_point(&main_ant.pos, GRID_SIZE_Y / 2, GRID_SIZE_X / 2);
-    set_ant_dir(&main_ant, dir[0]);
-    init_grid(grid);
-    render_grid(grid, row, col, &grid_offset);
-    render_ant(&main_ant, row, col, &grid_offset);
-    step_count = 0;
+    memset(&current, 0, sizeof(frame));
+    current.step_count = sim.step_count;
+    current.state = RUNNING;
+    current.speed = DEFAULT_SPEED;
+    memset(&shown, 0, sizeof(view));
     mvprintw(row - 1, 0, "%s-%s\n", dir, pattern);
-    mvprintw(row - 1, step_col, "Step: %d\n", step_count);
     mvprintw(row - 1, col - strlen(quit_msg), "%s", quit_msg);
-    state = RUNNING;
     refresh();
+    init_hud(&perf);
 
-    // Main loop
-    while ((ch = getch()) != 'q') {
+    // Hand the world to the simulation thread
+    send_command(&sim.commands, 0, row, col, &grid_offset, zoom);
+    if (pthread_create(&sim_thread, NULL, run_simulation, &sim) != 0) {
+        endwin();
+        free_grid(&sim.world);
+        free_dirty(&sim.dirty);
+        free_channel(&sim.frames);
+        free_channel(&sim.commands);
+        printf("Could not start the simulation thread\n");
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &frame_deadline);
+    quit = 0;
+
+    // Main loop, drawing the newest frame every FRAME_NS
+    while (!quit) {
         // Flags
         int refresh_screen = 0;
-        int reset = 0;
+        int view_changed = 0;
+        frame *f;
 
-        // Check for these inputs regardless of state
-        if (ch == KEY_RESIZE) {
-            getmaxyx(stdscr, row, col);
-            refresh_screen = 1;
-        } else if (ch == KEY_LEFT) {
-            update_offset(&grid_offset, LEFT);
-            refresh_screen = 1;
-        } else if (ch == KEY_UP) {
-            update_offset(&grid_offset, UP);
-            refresh_screen = 1;
-        } else if (ch == KEY_RIGHT) {
-            update_offset(&grid_offset, RIGHT);
-            refresh_screen = 1;
-        } else if (ch == KEY_DOWN) {
-            update_offset(&grid_offset, DOWN);
-            refresh_screen = 1;
-        } else if (ch == 'c') {
-            update_offset(&grid_offset, ZERO);
-            refresh_screen = 1;
-        } else if (ch == 'a') {
-            center_ant(&main_ant, row, col, &grid_offset);
-            refresh_screen = 1;
-        } else if (state == RUNNING) {
-            // Check these only when running
-            if (ch == ERR) {
-                update_grid(grid, &main_ant, pattern);
-                if (main_ant.pos.y < 0 || main_ant.pos.y >= GRID_SIZE_Y ||
-                        main_ant.pos.x < 0 ||
-                        main_ant.pos.x >= GRID_SIZE_X) {
-                    state = GAME_OVER;
-                    continue;
-                }
-                if (step_count < UINT_MAX) {
-                    step_count++;
+        // Handle all pending input without blocking
+        while ((ch = getch()) != ERR) {
+            int key = 0;
+
+            if (ch == 'q') {
+                quit = 1;
+                break;
+            }
+            if (ch == KEY_RESIZE) {
+                getmaxyx(stdscr, row, col);
+                view_changed = 1;
+            } else if (ch == KEY_LEFT) {
+                update_offset(&grid_offset, LEFT);
+                view_changed = 1;
+            } else if (ch == KEY_UP) {
+                update_offset(&grid_offset, UP);
+                view_changed = 1;
+            } else if (ch == KEY_RIGHT) {
+                update_offset(&grid_offset, RIGHT);
+                view_changed = 1;
+            } else if (ch == KEY_DOWN) {
+                update_offset(&grid_offset, DOWN);
+                view_changed = 1;
+            } else if (ch == 'c') {
+                update_offset(&grid_offset, ZERO);
+                view_changed = 1;
+            } else if (ch == 'a') {
+                center_ant(&shown.a, row, col, &grid_offset);
+                view_changed = 1;
+            } else if (ch == '+' || ch == '=' || ch == '-') {
+                int to = ch == '-' ? zoom + 1 : zoom - 1;
+
+                if (to >= 0 && to <= MAX_ZOOM) {
+                    zoom_offset(&grid_offset, zoom, to);
+                    zoom = to;
+                    zoom_label[0] = '\0';
+                    if (zoom > 0) {
+                        snprintf(zoom_label, sizeof(zoom_label),
+                                "  Zoom: 1:%d", 1 << zoom);
+                    }
+                    view_changed = 1;
                 }
+            } else if (ch == 'i') {
+                // Showing or hiding the overlay repaints what it covers
+                show_hud = !show_hud;
+                redraw_all = 1;
                 refresh_screen = 1;
-            } else if (ch == 'p') {
-                state = PAUSED;
-                mvprintw(row - 1, (col - strlen(paused_msg)) / 2, "%s",
-                        paused_msg);
-            } else if (ch == 'r') {
-                reset = 1;
-            } else if (ch == '1') {
-                halfdelay(10);
-            } else if (ch == '2') {
-                halfdelay(5);
-            } else if (ch == '3') {
-                halfdelay(1);
-            }
-        } else if (state == PAUSED) {
-            // Check these only when paused
-            if (ch == 'p') {
-                state = RUNNING;
-                mvprintw(row - 1, (col - strlen(paused_msg)) / 2,
-                        "          ");
+            } else {
+                // The simulation thread decides what the other keys do
+                if (ch == 'r' && current.state != PAUSED) {
+                    update_offset(&grid_offset, ZERO);
+                }
+                key = ch;
             }
-        } else if (state == GAME_OVER) {
-            // Check these only when game over
-            if (ch == 'r') {
-                reset = 1;
+            if (key != 0 && send_command(&sim.commands, key, row, col,
+                        &grid_offset, zoom) == 0) {
+                view_changed = 0;
             }
         }
+        if (quit) {
+            break;
+        }
+        if (view_changed) {
+            // Retried next frame if the simulation thread is behind
+            send_command(&sim.commands, 0, row, col, &grid_offset, zoom);
+        }
 
-        // Check flags
-        if (reset) {
-            update_offset(&grid_offset, ZERO);
-            halfdelay(5);
-            set_point(&main_ant.pos, GRID_SIZE_Y / 2, GRID_SIZE_X / 2);
-            set_ant_dir(&main_ant, dir[0]);
-            init_grid(grid);
-            step_count = 0;
-            state = RUNNING;
+        // Take the newest frame, skipping any that were never drawn
+        if ((f = get_newest_slot(&sim.frames)) != NULL) {
+            struct timespec start, end;
+            int drawn;
+
+            perf.steps += f->steps - current.steps;
+            perf.step_ns += f->step_ns - current.step_ns;
+#ifdef ANT_STATS
+            perf.sim = f->counters;
+#endif
+            if (f->notice_count != current.notice_count) {
+                notice = f->notice;
+                notice_frames = 2 * FPS;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if ((drawn = draw_view(&f->v, &shown, redraw_all)) < 0) {
+                quit = 1;
+            } else {
+                perf.cells_drawn += drawn;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            perf.render_ns += elapsed_seconds(&start, &end) * 1e9;
+            current = *f;
+            memset(&current.v, 0, sizeof(view));
+            receive_slot(&sim.frames);
+            redraw_all = 0;
+            refresh_screen = 1;
+        }
+        if (notice != NULL && --notice_frames < 0) {
+            notice = NULL;
+            refresh_screen = 1;
+        }
+        if (update_hud(&perf) && show_hud) {
             refresh_screen = 1;
         }
         if (refresh_screen) {
-            if (ch != ERR) {
-                clear();
+            if (show_hud) {
+                render_hud(&perf, &current, row, col);
             }
-            render_grid(grid, row, col, &grid_offset);
-            render_ant(&main_ant, row, col, &grid_offset);
             mvprintw(row - 1, 0, "%s-%s\n", dir, pattern);
-            mvprintw(row - 1, step_col, "Step: %d\n", step_count);
-            if (state == PAUSED) {
+            mvprintw(row - 1, step_col, "Step: %llu  Speed: %s%s%s\n",
+                    current.step_count, speeds[current.speed].label,
+                    current.reverse ? " (rewind)" : "", zoom_label);
+            if (current.state == PAUSED) {
                 mvprintw(row - 1, (col - strlen(paused_msg)) / 2, "%s",
                         paused_msg);
             }
+            if (notice != NULL) {
+                mvprintw(row - 1, col - strlen(quit_msg) - strlen(notice) - 2,
+                        "%s", notice);
+            }
             mvprintw(row - 1, col - strlen(quit_msg), "%s", quit_msg);
             refresh();
         }
+
+        // Wait for the next frame, skipping ahead if we fell behind
+        add_nanoseconds(&frame_deadline, FRAME_NS);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (elapsed_seconds(&frame_deadline, &now) > 0) {
+            frame_deadline = now;
+        }
+        sleep_until(&frame_deadline);
     }
 
+    // Stop the simulation thread, waiting for room in its channel
+    while (send_command(&sim.commands, 'q', row, col, &grid_offset,
+                zoom) != 0) {
+        add_nanoseconds(&frame_deadline, FRAME_NS);
+        sleep_until(&frame_deadline);
+    }
+    pthread_join(sim_thread, NULL);
+
     // Clean-up
     endwin();
+    free_grid(&sim.world);
+    free_dirty(&sim.dirty);
+    free_view(&sim.model);
+    free_view(&shown);
+    for (unsigned long i = 0; i < sim.frames.capacity; i++) {
+        free_view(&((frame *) sim.frames.slots)[i].v);
+    }
+    free_channel(&sim.frames);
+    free_channel(&sim.commands);
     return 0;
 }
@@ -0,0 +1,234 @@
+/*
+ * render.c
+ */
+
+#include <ncurses.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "render.h"
+
+// Cell value that never matches a color, so the cell is drawn next frame
+#define STALE_CELL 0xff
+
+static int get_first_column(view *v, point *origin)
+{
+    /*
+     * Return the first column of the terminal a cell of the view starts
+     * on, and the screen position of tile (0, 0).
+     *
+     * param v - View whose terminal size and offset are used
+     * param origin - Pointer to the screen position of tile (0, 0)
+     * return - 0 or 1
+     */
+    *origin = get_grid_origin(v->row, v->col, &v->grid_offset);
+    return origin->x & 1;
+}
+
+static void capture_cell(view *v, grid *g, point *origin, int first,
+        point *b)
+{
+    /*
+     * Store the color of a block in its cell, if it is visible.
+     *
+     * param v - View to update
+     * param g - Grid that holds the block
+     * param origin - Pointer to the screen position of tile (0, 0)
+     * param first - First column a cell starts on
+     * param b - Pointer to the coordinates of the block, in blocks
+     */
+    int y = origin->y + b->y;
+    int x = origin->x + b->x * 2 - first;
+
+    if (y < 0 || y >= v->lines || x < 0 || x / 2 >= v->width) {
+        return;
+    }
+    v->cells[y * v->width + x / 2] = get_block_color(g, b, v->zoom);
+}
+
+int capture_view(view *v, grid *g, ant *a, dirty_list *d)
+{
+    /*
+     * Bring a view up to date with the grid: the cells of the tiles that
+     * changed since the last capture, or every cell if too many changed or
+     * the view's terminal size, offset or zoom changed (d->full_redraw).
+     *
+     * param v - View to update, with its terminal size, offset and zoom set
+     * param g - Grid to capture
+     * param a - Pointer to the ant to show
+     * param d - Dirty list of changed tiles, cleared afterwards
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    point origin;
+    int first = get_first_column(v, &origin);
+    int lines = v->row > 1 ? v->row - 1 : 0;
+    int width = v->col > first ? (v->col - first) / 2 : 0;
+    size_t size = (size_t) lines * width;
+
+    if (size > v->capacity) {
+        unsigned char *cells = realloc(v->cells, size);
+
+        if (cells == NULL) {
+            return -1;
+        }
+        v->cells = cells;
+        v->capacity = size;
+    }
+    if (lines != v->lines || width != v->width) {
+        d->full_redraw = 1;
+    }
+    v->lines = lines;
+    v->width = width;
+    v->a = *a;
+    if (d->full_redraw) {
+        point min, max, b;
+
+        // Everything outside the allocated chunks is black
+        memset(v->cells, 0, size);
+        if (g->chunk_count > 0) {
+            set_point(&min, (g->chunk_min.y * CHUNK_SIZE) >> v->zoom,
+                    (g->chunk_min.x * CHUNK_SIZE) >> v->zoom);
+            set_point(&max, (g->chunk_max.y * CHUNK_SIZE + CHUNK_MASK) >>
+                    v->zoom, (g->chunk_max.x * CHUNK_SIZE + CHUNK_MASK) >>
+                    v->zoom);
+            // Only visit blocks that are both allocated and on screen
+            min.y = -origin.y > min.y ? -origin.y : min.y;
+            max.y = lines - 1 - origin.y < max.y ? lines - 1 - origin.y :
+                max.y;
+            min.x = (first - origin.x) / 2 > min.x ?
+                (first - origin.x) / 2 : min.x;
+            max.x = (first - origin.x) / 2 + width - 1 < max.x ?
+                (first - origin.x) / 2 + width - 1 : max.x;
+            for (b.y = min.y; b.y <= max.y; b.y++) {
+                for (b.x = min.x; b.x <= max.x; b.x++) {
+                    capture_cell(v, g, &origin, first, &b);
+                }
+            }
+        }
+    } else {
+        for (int i = 0; i < d->count; i++) {
+            point b = {d->cells[i].y >> v->zoom, d->cells[i].x >> v->zoom};
+
+            capture_cell(v, g, &origin, first, &b);
+        }
+    }
+    clear_dirty(d);
+    return 0;
+}
+
+int copy_view(view *to, view *from)
+{
+    /*
+     * Copy a view, cells included.
+     *
+     * param to - View to overwrite
+     * param from - View to copy
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    size_t size = (size_t) from->lines * from->width;
+    unsigned char *cells = to->cells;
+    size_t capacity = to->capacity;
+
+    if (size > capacity) {
+        if ((cells = realloc(cells, size)) == NULL) {
+            return -1;
+        }
+        capacity = size;
+    }
+    *to = *from;
+    to->cells = cells;
+    to->capacity = capacity;
+    memcpy(to->cells, from->cells, size);
+    return 0;
+}
+
+int draw_view(view *v, view *shown, int full)
+{
+    /*
+     * Draw a view over the one on screen, only redrawing cells whose color
+     * differs unless the terminal size, offset or zoom changed, then draw
+     * the ant on top.
+     *
+     * param v - View to draw
+     * param shown - View currently on screen, updated to v
+     * param full - 1 (true) to redraw every cell, e.g. after an overlay
+     *   was hidden
+     * return - Number of cells drawn, or -1 if memory could not be
+     *   allocated
+     */
+    point origin;
+    int first = get_first_column(v, &origin);
+    int drawn = 0;
+    int y, x;
+
+    full = full || shown->cells == NULL || shown->row != v->row ||
+        shown->col != v->col || shown->zoom != v->zoom ||
+        shown->grid_offset.y != v->grid_offset.y ||
+        shown->grid_offset.x != v->grid_offset.x;
+    if (full) {
+        erase();
+    }
+    for (int i = 0; i < v->lines * v->width; i++) {
+        int tile = v->cells[i];
+        chtype ch;
+
+        if (full ? tile == 0 : tile == shown->cells[i]) {
+            continue;
+        }
+        drawn++;
+        /*
+         * ncurses has only 8 bg colors, so use characters to indicate
+         * colors 8 - 15
+         */
+        ch = (tile > 7 ? '#' : ' ') | COLOR_PAIR(tile % 8);
+        mvaddch(i / v->width, first + i % v->width * 2, ch);
+        addch(ch);
+    }
+    if (copy_view(shown, v) != 0) {
+        return -1;
+    }
+    render_ant(&shown->a, v->row, v->col, &v->grid_offset, v->zoom);
+    // The ant covers its cell, which must be drawn again once it leaves
+    y = shown->a.screen_pos.y;
+    x = shown->a.screen_pos.x - first;
+    if (y >= 0 && y < v->lines && x >= 0 && x / 2 < v->width) {
+        shown->cells[y * v->width + x / 2] = STALE_CELL;
+    }
+    return drawn;
+}
+
+void free_view(view *v)
+{
+    /*
+     * Release the cells of a view.
+     *
+     * param v - View to free
+     */
+    free(v->cells);
+    v->cells = NULL;
+    v->capacity = 0;
+}
+
+void render_ant(ant *a, int row, int col, point *grid_offset, int zoom)
+{
+    /*
+     * Draw the ant in the terminal.
+     *
+     * param a - Pointer to the ant to draw
+     * param row - The number of rows (lines) displayed by the terminal
+     * param col - The number of columns displayed by the terminal
+     * param grid_offset - Pointer to the grid offset
+     * param zoom - log2 of the number of tiles on a side of a drawn block
+     */
+    int acs_dir_sym[4] = {ACS_LARROW, ACS_UARROW, ACS_RARROW, ACS_DARROW};
+    point origin = get_grid_origin(row, col, grid_offset);
+    int y = origin.y + (a->pos.y >> zoom);
+    int x = origin.x + (a->pos.x >> zoom) * 2;
+
+    // Draw ant, using a different symbol depending on its direction
+    attron(COLOR_PAIR(RED));
+    mvaddch(y, x, acs_dir_sym[a->dir]);
+    mvaddch(y, x + 1, acs_dir_sym[a->dir]);
+    attroff(COLOR_PAIR(RED));
+    set_point(&a->screen_pos, y, x);
+}
@@ -0,0 +1,40 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+/*
+ * render.h
+ *
+ * Drawing of the grid and ants with ncurses. Kept apart from the engine so
+ * that the engine builds as a library without ncurses.
+ */
+
+#include <stddef.h>
+
+#include "ant.h"
+#include "grid.h"
+#include "point.h"
+
+/*
+ * The blocks of tiles visible in the terminal, captured from the grid by
+ * one thread and drawn by another. Each line of the terminal above the
+ * status bar holds width cells, each two columns wide, starting at the
+ * column of the same parity as tile (0, 0).
+ */
+typedef struct {
+    // Terminal size, grid offset and zoom the view is captured for
+    int row, col;
+    point grid_offset;
+    int zoom;
+    int lines, width;
+    unsigned char *cells;
+    size_t capacity;
+    ant a;
+} view;
+
+int capture_view(view *v, grid *g, ant *a, dirty_list *d);
+int copy_view(view *to, view *from);
+int draw_view(view *v, view *shown, int full);
+void free_view(view *v);
+void render_ant(ant *a, int row, int col, point *grid_offset, int zoom);
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * rule.c
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include "ant.h"
+#include "rule.h"
+
+void compile_rule(rule *r, char *pattern)
+{
+    /*
+     * Compile a pattern string into a transition table so that the ant
+     * never has to parse the pattern while stepping.
+     *
+     * param r - Pointer to the rule to fill in
+     * param pattern - String pattern that determines the ant's behavior
+     *   Must be between two and MAX_COLORS valid characters long
+     */
+    memset(r, 0, sizeof(rule));
+    r->colors = strlen(pattern);
+    strcpy(r->pattern, pattern);
+    for (int color = 0; color < r->colors; color++) {
+        int turn = 0;
+
+        switch (toupper((unsigned char) pattern[color])) {
+            case 'R':
+                // Turn clockwise 90 degrees
+                turn = 1;
+                break;
+            case 'L':
+                // Turn counter-clockwise 90 degrees
+                turn = 3;
+                break;
+            case 'U':
+                // Turn 180 degrees
+                turn = 2;
+                break;
+            case 'N':
+                // Do nothing
+                turn = 0;
+                break;
+        }
+        for (int dir = 0; dir < 4; dir++) {
+            transition *t = &r->table[color][dir];
+            transition *u;
+
+            t->dir = (dir + turn) % 4;
+            t->next = (color + 1) % r->colors;
+            t->dy = ant_dir_offsets[t->dir].y;
+            t->dx = ant_dir_offsets[t->dir].x;
+            u = &r->inverse[t->next][t->dir];
+            u->dir = dir;
+            u->next = color;
+            u->dy = -t->dy;
+            u->dx = -t->dx;
+        }
+    }
+    // Colors written by ants with longer patterns read as color % colors
+    for (int color = r->colors; color < MAX_COLORS; color++) {
+        memcpy(r->table[color], r->table[color % r->colors],
+                sizeof(r->table[color]));
+        memcpy(r->inverse[color], r->inverse[color % r->colors],
+                sizeof(r->inverse[color]));
+    }
+}
+
+int is_valid_pattern(char *pattern)
+{
+    /*
+     * Return 1 (true) if the string is a valid pattern, 0 (false) if not.
+     *
+     * param pattern - String to check
+     * return - 1 (true) if pattern is two to MAX_COLORS characters long and
+     *   only uses the characters L, R, U and N (either case)
+     */
+    size_t len = strlen(pattern);
+
+    if (len < 2 || len > MAX_COLORS) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (strchr("LlRrUuNn", pattern[i]) == NULL) {
+            return 0;
+        }
+    }
+    return 1;
+}
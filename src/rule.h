@@ -0,0 +1,40 @@
+#ifndef RULE_H
+#define RULE_H
+
+/*
+ * rule.h
+ */
+
+#define MAX_COLORS 16
+
+/*
+ * Result of the ant standing on a tile of a given color while facing a
+ * given direction.
+ */
+typedef struct {
+    unsigned char dir;
+    unsigned char next;
+    signed char dy, dx;
+} transition;
+
+/*
+ * A pattern compiled into a transition table indexed by
+ * [tile color][ant direction]. Rows past the pattern length wrap around,
+ * so ants with different patterns can share a grid.
+ *
+ * The inverse table undoes a step. It is indexed by the color the ant
+ * left behind and the direction it now faces, and gives the direction it
+ * faced and the color the tile had before the step. dy, dx reverse the
+ * move, which depends only on the direction.
+ */
+typedef struct {
+    int colors;
+    char pattern[MAX_COLORS + 1];
+    transition table[MAX_COLORS][4];
+    transition inverse[MAX_COLORS][4];
+} rule;
+
+void compile_rule(rule *r, char *pattern);
+int is_valid_pattern(char *pattern);
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * simulation.c
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ant.h"
+#include "grid.h"
+#include "point.h"
+#include "rule.h"
+#include "simulation.h"
+
+struct simulation {
+    grid world;
+    ant main_ant;
+    rule main_rule;
+    unsigned long long step_count;
+};
+
+simulation *create_simulation(char *pattern, char dir)
+{
+    /*
+     * Create a simulation of an ant at tile (0, 0) on an all-black grid.
+     *
+     * param pattern - String pattern that determines the ant's behavior
+     * param dir - Ant's starting direction: L, U, R or D (either case)
+     * return - The simulation, or NULL if the pattern or direction is not
+     *   valid or memory could not be allocated
+     */
+    simulation *s;
+
+    if (pattern == NULL || !is_valid_pattern(pattern) || dir == '\0' ||
+            strchr("LURD", toupper((unsigned char) dir)) == NULL) {
+        return NULL;
+    }
+    if ((s = malloc(sizeof(simulation))) == NULL) {
+        return NULL;
+    }
+    compile_rule(&s->main_rule, pattern);
+    init_grid(&s->world, choose_tile_bits(s->main_rule.colors));
+    set_point(&s->main_ant.pos, 0, 0);
+    set_ant_dir(&s->main_ant, dir);
+    s->step_count = 0;
+    return s;
+}
+
+void free_simulation(simulation *s)
+{
+    /*
+     * Free a simulation and everything it holds.
+     *
+     * param s - Simulation to free, or NULL
+     */
+    if (s == NULL) {
+        return;
+    }
+    free_grid(&s->world);
+    free(s);
+}
+
+void get_simulation_ant(simulation *s, int *y, int *x, char *dir)
+{
+    /*
+     * Read the position and direction of the ant.
+     *
+     * param s - Simulation to read
+     * param y - Pointer to the ant's row
+     * param x - Pointer to the ant's column
+     * param dir - Pointer to the ant's direction: L, U, R or D
+     */
+    *y = s->main_ant.pos.y;
+    *x = s->main_ant.pos.x;
+    *dir = "LURD"[s->main_ant.dir];
+}
+
+int get_simulation_bounds(simulation *s, int *min_y, int *min_x,
+        int *max_y, int *max_x)
+{
+    /*
+     * Find the smallest rectangle that holds every tile that is not black.
+     *
+     * param s - Simulation to read
+     * param min_y - Pointer to the top row of the rectangle
+     * param min_x - Pointer to the left column of the rectangle
+     * param max_y - Pointer to the bottom row of the rectangle
+     * param max_x - Pointer to the right column of the rectangle
+     * return - 0 on success, -1 if every tile is black
+     */
+    point min, max;
+
+    if (get_bounds(&s->world, &min, &max) != 0) {
+        return -1;
+    }
+    *min_y = min.y;
+    *min_x = min.x;
+    *max_y = max.y;
+    *max_x = max.x;
+    return 0;
+}
+
+unsigned long long get_simulation_steps(simulation *s)
+{
+    /*
+     * Return the number of steps the ant has taken.
+     *
+     * param s - Simulation to read
+     * return - Number of steps taken
+     */
+    return s->step_count;
+}
+
+int get_simulation_tile(simulation *s, int y, int x)
+{
+    /*
+     * Return the value (color) of a tile, where color n is the n-th turn of
+     * the pattern.
+     *
+     * param s - Simulation to read
+     * param y - Row of the tile
+     * param x - Column of the tile
+     * return - Value of the tile, 0 (black) if it was never changed
+     */
+    point p = {y, x};
+
+    return get_tile(&s->world, &p);
+}
+
+int step_simulation(simulation *s, unsigned long long n)
+{
+    /*
+     * Advance the ant n steps in one call. The steps run in the engine's
+     * batched loops, which only look up a chunk when the ant leaves one.
+     *
+     * param s - Simulation to advance
+     * param n - Number of steps to take
+     * return - 0 on success, -1 if memory could not be allocated, in which
+     *   case the steps taken before running out are still counted
+     */
+    return step_grid(&s->world, &s->main_ant, &s->main_rule, &s->step_count,
+            n);
+}
@@ -0,0 +1,23 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+/*
+ * simulation.h
+ *
+ * Embeddable interface to the engine, built as liblangtons_ant ("make
+ * lib"). A simulation is one ant on an unbounded grid, reached only
+ * through an opaque handle.
+ */
+
+typedef struct simulation simulation;
+
+simulation *create_simulation(char *pattern, char dir);
+void free_simulation(simulation *s);
+void get_simulation_ant(simulation *s, int *y, int *x, char *dir);
+int get_simulation_bounds(simulation *s, int *min_y, int *min_x,
+        int *max_y, int *max_x);
+unsigned long long get_simulation_steps(simulation *s);
+int get_simulation_tile(simulation *s, int y, int x);
+int step_simulation(simulation *s, unsigned long long n);
+
+#endif
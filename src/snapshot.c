@@ -0,0 +1,285 @@
+/*
+ * snapshot.c
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+static int is_empty_chunk(unsigned char *tiles, size_t size)
+{
+    /*
+     * Return 1 (true) if every tile of a chunk is 0 (color Black).
+     *
+     * param tiles - Packed tiles of the chunk
+     * param size - Number of bytes of packed tiles
+     * return - 1 (true) if the chunk is all black, 0 (false) if not
+     */
+    for (size_t i = 0; i < size; i++) {
+        if (tiles[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int has_valid_tiles(unsigned char *tiles, size_t size, int bits,
+        int colors)
+{
+    /*
+     * Return 1 (true) if every tile of a chunk holds one of the pattern's
+     * colors.
+     *
+     * param tiles - Packed tiles of the chunk
+     * param size - Number of bytes of packed tiles
+     * param bits - Bits per tile
+     * param colors - Number of colors of the pattern
+     * return - 1 (true) if every tile is valid, 0 (false) if not
+     */
+    if (colors >= 1 << bits) {
+        return 1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        for (int shift = 0; shift < 8; shift += bits) {
+            if (((tiles[i] >> shift) & ((1 << bits) - 1)) >= colors) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+int load_snapshot(char *path, grid *g, ant *a, rule *r, char *start_dir,
+        unsigned long long *step_count)
+{
+    /*
+     * Restore a world from a snapshot file. The file is mapped into memory
+     * and its chunks are copied straight into the grid's pool, so even
+     * very large worlds load at the speed of a memory copy.
+     *
+     * param path - Path of the snapshot file
+     * param g - Grid to load into. Must not hold any memory; on failure it
+     *   is left holding none
+     * param a - Ant to restore
+     * param r - Rule to compile from the stored pattern
+     * param start_dir - Pointer to the ant's direction at step 0
+     * param step_count - Pointer to the number of steps already taken
+     * return - 0 on success, -1 if the file could not be read or is not a
+     *   valid snapshot
+     */
+    struct stat st;
+    unsigned char *data;
+    int status;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    status = read_snapshot(data, st.st_size, g, a, r, start_dir,
+            step_count);
+    munmap(data, st.st_size);
+    return status;
+}
+
+int read_snapshot(unsigned char *data, size_t size, grid *g, ant *a,
+        rule *r, char *start_dir, unsigned long long *step_count)
+{
+    /*
+     * Restore a world from a snapshot held in memory.
+     *
+     * param data - Bytes of the snapshot
+     * param size - Number of bytes
+     * param g - Grid to load into. Must not hold any memory; on failure it
+     *   is left holding none
+     * param a - Ant to restore
+     * param r - Rule to compile from the stored pattern
+     * param start_dir - Pointer to the ant's direction at step 0
+     * param step_count - Pointer to the number of steps already taken
+     * return - 0 on success, -1 if the bytes are not a valid snapshot
+     */
+    snapshot_header h;
+    unsigned char *record;
+    size_t tile_bytes, record_size;
+    char pattern[MAX_COLORS + 1];
+    point min = {0, 0};
+    point max = {0, 0};
+
+    if (size < sizeof(h)) {
+        return -1;
+    }
+    // Check the header before trusting anything it says
+    memcpy(&h, data, sizeof(h));
+    memcpy(pattern, h.pattern, sizeof(pattern));
+    pattern[MAX_COLORS] = '\0';
+    tile_bytes = TILES_PER_CHUNK * h.tile_bits / 8;
+    record_size = 2 * sizeof(int32_t) + tile_bytes;
+    if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 ||
+            h.version != SNAPSHOT_VERSION ||
+            h.byte_order != SNAPSHOT_BYTE_ORDER ||
+            (h.tile_bits != 1 && h.tile_bits != 4 && h.tile_bits != 8) ||
+            !is_valid_pattern(pattern) ||
+            strchr("LURD", h.start_dir) == NULL || h.start_dir == '\0' ||
+            h.morton != TILE_LAYOUT_MORTON ||
+            h.ant_dir < ANT_LEFT || h.ant_dir > ANT_DOWN ||
+            size != sizeof(h) + h.chunk_count * record_size) {
+        return -1;
+    }
+    compile_rule(r, pattern);
+    if ((1 << h.tile_bits) < r->colors) {
+        return -1;
+    }
+
+    init_grid(g, h.tile_bits);
+    record = data + sizeof(h);
+    for (uint32_t i = 0; i < h.chunk_count; i++) {
+        int32_t origin[2];
+        chunk *c;
+
+        memcpy(origin, record, sizeof(origin));
+        // Every tile of the chunk must have coordinates that fit an int32_t
+        if (origin[0] < INT32_MIN / CHUNK_SIZE ||
+                origin[0] > INT32_MAX / CHUNK_SIZE ||
+                origin[1] < INT32_MIN / CHUNK_SIZE ||
+                origin[1] > INT32_MAX / CHUNK_SIZE ||
+                !has_valid_tiles(record + sizeof(origin), tile_bytes,
+                    h.tile_bits, r->colors) ||
+                (c = get_chunk(g, origin[0], origin[1])) == NULL) {
+            free_grid(g);
+            return -1;
+        }
+        memcpy(c->tiles, record + sizeof(origin), tile_bytes);
+        record += record_size;
+    }
+    // The stored rectangle must be the one the chunks hold
+    get_bounds(g, &min, &max);
+    if (min.y != h.min_y || min.x != h.min_x || max.y != h.max_y ||
+            max.x != h.max_x) {
+        free_grid(g);
+        return -1;
+    }
+
+    set_point(&a->pos, h.ant_y, h.ant_x);
+    a->dir = h.ant_dir;
+    *start_dir = h.start_dir;
+    *step_count = h.step_count;
+    return 0;
+}
+
+int save_snapshot(char *path, grid *g, ant *a, rule *r, char start_dir,
+        unsigned long long step_count)
+{
+    /*
+     * Write the world to a snapshot file. The snapshot is written next to
+     * path and renamed over it once complete, so an interrupted save
+     * never destroys the previous checkpoint.
+     *
+     * param path - Path of the snapshot file
+     * param g - Grid to save
+     * param a - Ant to save
+     * param r - Rule whose pattern is saved
+     * param start_dir - Ant's direction at step 0
+     * param step_count - Number of steps taken so far
+     * return - 0 on success, -1 if the file could not be written
+     */
+    size_t len = strlen(path);
+    char *tmp_path = malloc(len + 5);
+    int failed = 0;
+    FILE *f;
+
+    if (tmp_path == NULL) {
+        return -1;
+    }
+    memcpy(tmp_path, path, len);
+    strcpy(tmp_path + len, ".tmp");
+    if ((f = fopen(tmp_path, "wb")) == NULL) {
+        free(tmp_path);
+        return -1;
+    }
+    failed |= write_snapshot(f, g, a, r, start_dir, step_count) != 0;
+    failed |= fclose(f) != 0;
+
+    if (failed || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+    free(tmp_path);
+    return 0;
+}
+
+int write_snapshot(FILE *f, grid *g, ant *a, rule *r, char start_dir,
+        unsigned long long step_count)
+{
+    /*
+     * Write the world as a snapshot at the current position of a file,
+     * leaving the file positioned after it.
+     *
+     * param f - File to write to. Must be seekable
+     * param g - Grid to save
+     * param a - Ant to save
+     * param r - Rule whose pattern is saved
+     * param start_dir - Ant's direction at step 0
+     * param step_count - Number of steps taken so far
+     * return - 0 on success, -1 if the snapshot could not be written
+     */
+    snapshot_header h;
+    point min, max;
+    size_t tile_bytes = TILES_PER_CHUNK * g->tile_bits / 8;
+    long start = ftell(f);
+    int failed = start < 0;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SNAPSHOT_VERSION;
+    h.byte_order = SNAPSHOT_BYTE_ORDER;
+    h.tile_bits = g->tile_bits;
+    strcpy(h.pattern, r->pattern);
+    h.start_dir = start_dir;
+    h.morton = TILE_LAYOUT_MORTON;
+    h.ant_y = a->pos.y;
+    h.ant_x = a->pos.x;
+    h.ant_dir = a->dir;
+    h.step_count = step_count;
+    if (get_bounds(g, &min, &max) == 0) {
+        h.min_y = min.y;
+        h.min_x = min.x;
+        h.max_y = max.y;
+        h.max_x = max.x;
+    }
+
+    // Leave room for the header, which is written once the chunks are
+    failed |= fwrite(&h, sizeof(h), 1, f) != 1;
+    for (unsigned int i = 0; g->buckets != NULL && i < g->bucket_count;
+            i++) {
+        for (chunk *c = g->buckets[i]; c != NULL; c = c->next) {
+            int32_t origin[2] = {c->origin.y, c->origin.x};
+
+            if (is_empty_chunk(c->tiles, tile_bytes)) {
+                continue;
+            }
+            failed |= fwrite(origin, sizeof(origin), 1, f) != 1;
+            failed |= fwrite(c->tiles, tile_bytes, 1, f) != 1;
+            h.chunk_count++;
+        }
+    }
+    failed |= fseek(f, start, SEEK_SET) != 0;
+    failed |= fwrite(&h, sizeof(h), 1, f) != 1;
+    failed |= fseek(f, 0, SEEK_END) != 0;
+    return failed ? -1 : 0;
+}
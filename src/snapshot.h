@@ -0,0 +1,59 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/*
+ * snapshot.h
+ *
+ * Binary snapshots of a single-ant world, for checkpointing and resuming
+ * long runs.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ant.h"
+#include "grid.h"
+#include "rule.h"
+
+#define SNAPSHOT_MAGIC "LANTSNAP"
+#define SNAPSHOT_VERSION 2
+// Written in native byte order; reads back differently on other machines
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define DEFAULT_SNAPSHOT "langtons_ant.snap"
+
+/*
+ * A snapshot is this header followed by chunk_count chunk records. Each
+ * record is the chunk's coordinates (two int32_t) followed by its packed
+ * tiles, TILES_PER_CHUNK * tile_bits / 8 bytes in the grid's own layout.
+ * Snapshots only load into builds with the same layout.
+ * Chunks that are entirely black are left out. Every record is a multiple
+ * of 8 bytes, so the records of a mapped file stay aligned.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t tile_bits;
+    uint32_t chunk_count;
+    char pattern[MAX_COLORS + 1];
+    char start_dir;
+    // 1 if the tiles are in the Morton layout (TILE_LAYOUT_MORTON)
+    char morton;
+    char padding;
+    int32_t ant_y, ant_x, ant_dir;
+    // Smallest rectangle that holds every non-black tile, 0 if there is none
+    int32_t min_y, min_x, max_y, max_x;
+    uint64_t step_count;
+} snapshot_header;
+
+int load_snapshot(char *path, grid *g, ant *a, rule *r, char *start_dir,
+        unsigned long long *step_count);
+int read_snapshot(unsigned char *data, size_t size, grid *g, ant *a,
+        rule *r, char *start_dir, unsigned long long *step_count);
+int save_snapshot(char *path, grid *g, ant *a, rule *r, char start_dir,
+        unsigned long long step_count);
+int write_snapshot(FILE *f, grid *g, ant *a, rule *r, char start_dir,
+        unsigned long long step_count);
+
+#endif
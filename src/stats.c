@@ -0,0 +1,9 @@
+/*
+ * stats.c
+ */
+
+#include "stats.h"
+
+#ifdef ANT_STATS
+_Thread_local ant_stats stats;
+#endif
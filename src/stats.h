@@ -0,0 +1,31 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * stats.h
+ *
+ * Counters in the step path, shown by the performance overlay.
+ * They are only compiled in when ANT_STATS is defined ("make STATS=1");
+ * otherwise STAT_ADD expands to nothing and the hot paths are unchanged.
+ */
+
+#ifdef ANT_STATS
+
+typedef struct {
+    unsigned long long chunk_lookups;
+    unsigned long long chunk_cache_hits;
+    unsigned long long chunks_allocated;
+} ant_stats;
+
+// Per thread, so that worker threads never contend on the counters
+extern _Thread_local ant_stats stats;
+
+#define STAT_ADD(counter, n) (stats.counter += (n))
+
+#else
+
+#define STAT_ADD(counter, n) ((void) 0)
+
+#endif
+
+#endif
@@ -0,0 +1,334 @@
+/*
+ * sweep.c
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ant.h"
+#include "sweep.h"
+
+static int add_pattern(sweep *s, char *pattern, int *capacity)
+{
+    /*
+     * Append a pattern to the sweep, in uppercase.
+     *
+     * param s - Sweep to add the pattern to
+     * param pattern - Valid pattern to add
+     * param capacity - Pointer to the allocated size of s->patterns
+     * return - 0 on success, -1 if memory could not be allocated or there
+     *   are more than MAX_SWEEP_PATTERNS patterns
+     */
+    int i;
+
+    if (s->pattern_count == MAX_SWEEP_PATTERNS) {
+        return -1;
+    }
+    if (s->pattern_count == *capacity) {
+        int n = *capacity ? *capacity * 2 : 256;
+        char (*patterns)[MAX_COLORS + 1] = realloc(s->patterns,
+                n * sizeof(*patterns));
+
+        if (patterns == NULL) {
+            return -1;
+        }
+        s->patterns = patterns;
+        *capacity = n;
+    }
+    for (i = 0; pattern[i] != '\0'; i++) {
+        s->patterns[s->pattern_count][i] =
+            toupper((unsigned char) pattern[i]);
+    }
+    s->patterns[s->pattern_count++][i] = '\0';
+    return 0;
+}
+
+static void run_pattern(sweep *s, sweep_worker *w, int index)
+{
+    /*
+     * Run a single pattern from a blank grid and record its result.
+     *
+     * param s - Sweep that holds the pattern
+     * param w - Worker running the pattern
+     * param index - Index of the pattern in s->patterns
+     */
+    sweep_result *res = &s->results[index];
+    rule r;
+    ant a;
+    int bits;
+
+    compile_rule(&r, s->patterns[index]);
+    bits = choose_tile_bits(r.colors);
+    if (bits != w->world.tile_bits) {
+        free_grid(&w->world);
+        init_grid(&w->world, bits);
+        track_visited(&w->world);
+    } else {
+        reset_grid(&w->world);
+    }
+    init_highway(w->hw);
+    plan_final_check(w->hw, 0, s->steps);
+    set_point(&a.pos, 0, 0);
+    set_ant_dir(&a, s->dir);
+
+    strcpy(res->pattern, s->patterns[index]);
+    res->steps = 0;
+    res->failed = advance_ant(&w->world, &a, &r, w->hw, &res->steps,
+            s->steps) != 0;
+    res->pos = a.pos;
+    res->min = w->world.visited_min;
+    res->max = w->world.visited_max;
+    res->visited = w->world.visited_count;
+    if (w->hw->state == HIGHWAY_FOUND) {
+        res->period = w->hw->period;
+        res->displacement = w->hw->displacement;
+    } else {
+        res->period = 0;
+        set_point(&res->displacement, 0, 0);
+    }
+}
+
+static int take_task(sweep *s, sweep_worker *w)
+{
+    /*
+     * Return the next pattern for a worker to run, stealing from other
+     * workers once its own deque is empty.
+     *
+     * param s - Sweep that holds the workers
+     * param w - Worker looking for work
+     * return - Index of a pattern, or -1 if every deque is empty
+     */
+    int task = -1;
+
+    pthread_mutex_lock(&w->deque.lock);
+    if (w->deque.tail > w->deque.head) {
+        task = w->deque.tasks[--w->deque.tail];
+    }
+    pthread_mutex_unlock(&w->deque.lock);
+    for (int i = 1; task < 0 && i < s->thread_count; i++) {
+        task_deque *victim = &s->workers[(w->id + i) % s->thread_count].deque;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->tail > victim->head) {
+            task = victim->tasks[victim->head++];
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return task;
+}
+
+static void *run_sweep_worker(void *arg)
+{
+    /*
+     * Thread entry point: run patterns until there are none left.
+     *
+     * param arg - Pointer to the sweep_worker
+     * return - NULL
+     */
+    sweep_worker *w = arg;
+    int task;
+
+    while ((task = take_task(w->s, w)) >= 0) {
+        run_pattern(w->s, w, task);
+    }
+    return NULL;
+}
+
+int enumerate_patterns(sweep *s, int length, char *alphabet)
+{
+    /*
+     * Add every pattern of a given length over an alphabet to the sweep.
+     *
+     * param s - Sweep to add the patterns to
+     * param length - Length of the patterns, 2 to MAX_COLORS
+     * param alphabet - Distinct pattern characters to use, e.g. "LR"
+     * return - 0 on success, -1 if there would be more than
+     *   MAX_SWEEP_PATTERNS patterns or memory could not be allocated
+     */
+    int base = strlen(alphabet);
+    int capacity = 0;
+    unsigned long long count = 1;
+    char pattern[MAX_COLORS + 1];
+
+    for (int i = 0; i < length; i++) {
+        count *= base;
+        if (count > MAX_SWEEP_PATTERNS) {
+            return -1;
+        }
+    }
+    pattern[length] = '\0';
+    for (unsigned long long n = 0; n < count; n++) {
+        unsigned long long v = n;
+
+        // Digits of n in base len(alphabet), most significant first
+        for (int i = length - 1; i >= 0; i--) {
+            pattern[i] = alphabet[v % base];
+            v /= base;
+        }
+        if (add_pattern(s, pattern, &capacity) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void free_sweep(sweep *s)
+{
+    /*
+     * Release all memory held by the sweep.
+     *
+     * param s - Sweep to free
+     */
+    free(s->patterns);
+    free(s->results);
+    init_sweep(s);
+}
+
+void init_sweep(sweep *s)
+{
+    /*
+     * Initialize a sweep with no patterns.
+     *
+     * param s - Sweep to initialize
+     */
+    memset(s, 0, sizeof(sweep));
+}
+
+int load_patterns(sweep *s, char *path)
+{
+    /*
+     * Add the patterns listed in a file, one per line, to the sweep. Blank
+     * lines and lines starting with '#' are ignored.
+     *
+     * param s - Sweep to add the patterns to
+     * param path - Path of the pattern file
+     * return - 0 on success, -1 if the file could not be read or memory
+     *   could not be allocated, or the number of the first invalid line
+     */
+    FILE *f = fopen(path, "r");
+    char line[256];
+    int line_number = 0;
+    int capacity = s->pattern_count;
+
+    if (f == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *p = line;
+        char *end;
+
+        line_number++;
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        for (end = p; *end != '\0' && !isspace((unsigned char) *end); end++) {
+        }
+        *end = '\0';
+        if (!is_valid_pattern(p)) {
+            fclose(f);
+            return line_number;
+        }
+        if (add_pattern(s, p, &capacity) != 0) {
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+int run_sweep(sweep *s, unsigned long long steps, char dir, int threads)
+{
+    /*
+     * Run every pattern of the sweep for a number of steps on a pool of
+     * worker threads.
+     *
+     * param s - Sweep holding the patterns to run
+     * param steps - Number of steps to run each pattern for
+     * param dir - Starting direction of the ant (L, U, R or D)
+     * param threads - Number of worker threads, at least 1
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    int *tasks;
+    int status = 0;
+    int t;
+
+    s->steps = steps;
+    s->dir = dir;
+    s->thread_count = threads;
+    s->results = calloc(s->pattern_count, sizeof(sweep_result));
+    s->workers = calloc(threads, sizeof(sweep_worker));
+    tasks = malloc(s->pattern_count * sizeof(int));
+    if (s->results == NULL || s->workers == NULL || tasks == NULL) {
+        free(s->workers);
+        free(tasks);
+        return -1;
+    }
+    // Give each worker an equal contiguous share of the patterns
+    for (int i = 0; i < s->pattern_count; i++) {
+        tasks[i] = i;
+    }
+    for (t = 0; t < threads; t++) {
+        sweep_worker *w = &s->workers[t];
+
+        w->s = s;
+        w->id = t;
+        w->deque.tasks = tasks;
+        w->deque.head = (long long) s->pattern_count * t / threads;
+        w->deque.tail = (long long) s->pattern_count * (t + 1) / threads;
+        pthread_mutex_init(&w->deque.lock, NULL);
+        // Tile size is chosen for each pattern by run_pattern
+        init_grid(&w->world, 0);
+        if ((w->hw = malloc(sizeof(highway))) == NULL) {
+            status = -1;
+        }
+    }
+    if (status == 0) {
+        for (t = 1; t < threads; t++) {
+            if (pthread_create(&s->workers[t].thread, NULL,
+                        run_sweep_worker, &s->workers[t]) != 0) {
+                // The remaining deques are stolen by the running workers
+                break;
+            }
+        }
+        run_sweep_worker(&s->workers[0]);
+        while (--t > 0) {
+            pthread_join(s->workers[t].thread, NULL);
+        }
+    }
+    for (t = 0; t < threads; t++) {
+        free_grid(&s->workers[t].world);
+        free(s->workers[t].hw);
+        pthread_mutex_destroy(&s->workers[t].deque.lock);
+    }
+    free(s->workers);
+    s->workers = NULL;
+    free(tasks);
+    return status;
+}
+
+void write_sweep_csv(sweep *s, FILE *out)
+{
+    /*
+     * Write the results of a sweep as CSV, one row per pattern in the
+     * order the patterns were added.
+     *
+     * param s - Sweep that has been run
+     * param out - Stream to write to
+     */
+    fprintf(out, "pattern,steps,ant_y,ant_x,min_y,min_x,max_y,max_x,"
+            "visited,highway_period,highway_dy,highway_dx,status\n");
+    for (int i = 0; i < s->pattern_count; i++) {
+        sweep_result *r = &s->results[i];
+
+        fprintf(out, "%s,%llu,%d,%d,%d,%d,%d,%d,%llu,%d,%d,%d,%s\n",
+                r->pattern, r->steps, r->pos.y, r->pos.x, r->min.y,
+                r->min.x, r->max.y, r->max.x, r->visited, r->period,
+                r->displacement.y, r->displacement.x,
+                r->failed ? "out_of_memory" : "ok");
+    }
+}
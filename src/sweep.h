@@ -0,0 +1,70 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+/*
+ * sweep.h
+ *
+ * Classify many patterns by running each of them headless on a pool of
+ * worker threads.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "grid.h"
+#include "highway.h"
+#include "point.h"
+#include "rule.h"
+
+#define MAX_SWEEP_PATTERNS (1 << 24)
+
+typedef struct {
+    char pattern[MAX_COLORS + 1];
+    unsigned long long steps;
+    point pos;
+    point min, max;
+    unsigned long long visited;
+    int period;
+    point displacement;
+    int failed;
+} sweep_result;
+
+/*
+ * Each worker owns a deque of pattern indices. It takes work from the back
+ * of its own deque and, once that is empty, steals from the front of the
+ * others.
+ */
+typedef struct {
+    int *tasks;
+    int head, tail;
+    pthread_mutex_t lock;
+} task_deque;
+
+typedef struct {
+    struct sweep *s;
+    int id;
+    pthread_t thread;
+    task_deque deque;
+    // Grid and highway state reused between patterns
+    grid world;
+    highway *hw;
+} sweep_worker;
+
+typedef struct sweep {
+    char (*patterns)[MAX_COLORS + 1];
+    int pattern_count;
+    sweep_result *results;
+    unsigned long long steps;
+    char dir;
+    int thread_count;
+    sweep_worker *workers;
+} sweep;
+
+int enumerate_patterns(sweep *s, int length, char *alphabet);
+void free_sweep(sweep *s);
+void init_sweep(sweep *s);
+int load_patterns(sweep *s, char *path);
+int run_sweep(sweep *s, unsigned long long steps, char dir, int threads);
+void write_sweep_csv(sweep *s, FILE *out);
+
+#endif
@@ -0,0 +1,417 @@
+/*
+ * trajectory.c
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+#include "trajectory.h"
+
+// Longest run a single control byte of the run-length coding describes
+#define RUN_MAX 128
+
+static size_t pack_runs(unsigned char *in, size_t len, unsigned char *out)
+{
+    /*
+     * Run-length code bytes in the PackBits format: a control byte c below
+     * 128 is followed by c + 1 literal bytes, and one of 128 or more by a
+     * byte repeated 257 - c times.
+     *
+     * param in - Bytes to code
+     * param len - Number of bytes
+     * param out - Buffer of at least len + len / RUN_MAX + 1 bytes
+     * return - Number of bytes written to out
+     */
+    size_t i = 0, n = 0;
+
+    while (i < len) {
+        size_t run = 1;
+
+        while (i + run < len && run < RUN_MAX && in[i + run] == in[i]) {
+            run++;
+        }
+        if (run >= 3) {
+            out[n++] = 257 - run;
+            out[n++] = in[i];
+            i += run;
+            continue;
+        }
+        // Gather literals up to the next run of three or more
+        run = 0;
+        while (i + run < len && run < RUN_MAX && !(i + run + 2 < len &&
+                    in[i + run] == in[i + run + 1] &&
+                    in[i + run] == in[i + run + 2])) {
+            run++;
+        }
+        if (run == 0) {
+            continue;
+        }
+        out[n++] = run - 1;
+        memcpy(out + n, in + i, run);
+        n += run;
+        i += run;
+    }
+    return n;
+}
+
+static int unpack_runs(unsigned char *in, size_t len, unsigned char *out,
+        size_t size)
+{
+    /*
+     * Decode bytes coded by pack_runs.
+     *
+     * param in - Coded bytes
+     * param len - Number of coded bytes
+     * param out - Buffer receiving the decoded bytes
+     * param size - Number of bytes the decoded data must have
+     * return - 0 on success, -1 if the data does not decode to size bytes
+     */
+    size_t i = 0, n = 0;
+
+    while (i < len) {
+        unsigned int c = in[i++];
+        size_t run = c < RUN_MAX ? c + 1 : 257 - c;
+
+        if (n + run > size || i + (c < RUN_MAX ? run : 1) > len) {
+            return -1;
+        }
+        if (c < RUN_MAX) {
+            memcpy(out + n, in + i, run);
+            i += run;
+        } else {
+            memset(out + n, in[i++], run);
+        }
+        n += run;
+    }
+    return n == size ? 0 : -1;
+}
+
+static void write_record(recorder *rec, int type, unsigned long long step,
+        void *data, size_t len, void *extra, size_t extra_len)
+{
+    /*
+     * Write a record made of up to two pieces of data, then its padding.
+     *
+     * param rec - Recorder to write to
+     * param type - RECORD_KEYFRAME or RECORD_MOVES
+     * param step - Step of the record
+     * param data - First piece of data
+     * param len - Length of data
+     * param extra - Second piece of data, or NULL
+     * param extra_len - Length of extra
+     */
+    static const unsigned char zeros[8] = {0};
+    record_header h = {type, len + extra_len, step};
+    size_t pad = (8 - (len + extra_len) % 8) % 8;
+
+    rec->failed |= fwrite(&h, sizeof(h), 1, rec->f) != 1;
+    rec->failed |= fwrite(data, 1, len, rec->f) != len;
+    if (extra != NULL) {
+        rec->failed |= fwrite(extra, 1, extra_len, rec->f) != extra_len;
+    }
+    rec->failed |= fwrite(zeros, 1, pad, rec->f) != pad;
+}
+
+static void flush_moves(recorder *rec)
+{
+    /*
+     * Write the turns gathered so far as one move record and start a new
+     * one.
+     *
+     * param rec - Recorder to flush
+     */
+    moves_header m = {rec->block_ant.pos.y, rec->block_ant.pos.x,
+        rec->block_ant.dir, rec->count};
+    size_t len;
+
+    if (rec->count == 0) {
+        return;
+    }
+    len = pack_runs(rec->turns, (rec->count + 3) / 4, rec->packed);
+    write_record(rec, RECORD_MOVES, rec->block_step, &m, sizeof(m),
+            rec->packed, len);
+    memset(rec->turns, 0, sizeof(rec->turns));
+    rec->count = 0;
+}
+
+static void write_keyframe(recorder *rec, grid *g, ant *a, rule *r,
+        unsigned long long step_count)
+{
+    /*
+     * Write a snapshot of the world as a keyframe record. Recording fails
+     * if the snapshot is too large for a record.
+     *
+     * param rec - Recorder to write to
+     * param g - Grid to save
+     * param a - Ant to save
+     * param r - Rule of the ant
+     * param step_count - Number of steps taken so far
+     */
+    static const unsigned char zeros[8] = {0};
+    record_header h = {RECORD_KEYFRAME, 0, step_count};
+    long start, end;
+    size_t pad;
+
+    // The length is only known once the snapshot has been written
+    start = ftell(rec->f);
+    rec->failed |= start < 0;
+    rec->failed |= fwrite(&h, sizeof(h), 1, rec->f) != 1;
+    rec->failed |= write_snapshot(rec->f, g, a, r, rec->start_dir,
+            step_count) != 0;
+    end = ftell(rec->f);
+    rec->failed |= end < 0;
+    // A snapshot of 4 GiB or more does not fit the record's length
+    rec->failed |= (unsigned long long) (end - start) - sizeof(h) >
+        UINT32_MAX;
+    if (rec->failed) {
+        return;
+    }
+    h.length = end - start - sizeof(h);
+    pad = (8 - h.length % 8) % 8;
+    rec->failed |= fseek(rec->f, start, SEEK_SET) != 0;
+    rec->failed |= fwrite(&h, sizeof(h), 1, rec->f) != 1;
+    rec->failed |= fseek(rec->f, 0, SEEK_END) != 0;
+    rec->failed |= fwrite(zeros, 1, pad, rec->f) != pad;
+}
+
+static int apply_moves(grid *g, ant *a, rule *r, unsigned char *turns,
+        unsigned long long steps)
+{
+    /*
+     * Replay recorded turns: each step advances the color of the tile under
+     * the ant, turns the ant and moves it. A turn that the rule would not
+     * have made means the trajectory does not belong to the rule.
+     *
+     * param g - Grid to update
+     * param a - Pointer to the ant
+     * param r - Pointer to the compiled rule of the ant
+     * param turns - Turns packed four to a byte
+     * param steps - Number of turns to apply
+     * return - 0 on success, -1 if memory could not be allocated or a turn
+     *   does not match the rule
+     */
+    for (unsigned long long i = 0; i < steps; i++) {
+        int turn = (turns[i / 4] >> (i % 4 * 2)) & 3;
+        int value = get_tile(g, &a->pos);
+        transition *t = &r->table[value][a->dir];
+
+        if (t->dir != ((a->dir + turn) & 3) ||
+                change_tile(g, &a->pos, t->next) != 0) {
+            return -1;
+        }
+        a->dir = t->dir;
+        a->pos.y += t->dy;
+        a->pos.x += t->dx;
+    }
+    return 0;
+}
+
+int close_recorder(recorder *rec)
+{
+    /*
+     * Write the remaining turns and close the trajectory file.
+     *
+     * param rec - Recorder to close
+     * return - 0 on success, -1 if any part of the file could not be
+     *   written
+     */
+    flush_moves(rec);
+    rec->failed |= fclose(rec->f) != 0;
+    return rec->failed ? -1 : 0;
+}
+
+int open_recorder(recorder *rec, char *path, grid *g, ant *a, rule *r,
+        char start_dir, unsigned long long step_count,
+        unsigned long long keyframe_interval)
+{
+    /*
+     * Start recording a trajectory, beginning with a keyframe of the world
+     * as it is now.
+     *
+     * param rec - Recorder to initialize
+     * param path - Path of the trajectory file
+     * param g - Grid the ant walks on
+     * param a - Ant to record
+     * param r - Rule of the ant
+     * param start_dir - Ant's direction at step 0
+     * param step_count - Number of steps taken so far
+     * param keyframe_interval - Steps between keyframes
+     * return - 0 on success, -1 if the file could not be written
+     */
+    trajectory_header h;
+
+    memset(rec, 0, sizeof(recorder));
+    if ((rec->f = fopen(path, "wb")) == NULL) {
+        return -1;
+    }
+    rec->start_dir = start_dir;
+    rec->keyframe_interval = keyframe_interval;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TRAJECTORY_MAGIC, sizeof(h.magic));
+    h.version = TRAJECTORY_VERSION;
+    h.byte_order = TRAJECTORY_BYTE_ORDER;
+    h.keyframe_interval = keyframe_interval;
+    rec->failed |= fwrite(&h, sizeof(h), 1, rec->f) != 1;
+    write_keyframe(rec, g, a, r, step_count);
+    rec->block_step = step_count;
+    rec->block_ant = *a;
+    if (rec->failed) {
+        fclose(rec->f);
+        return -1;
+    }
+    return 0;
+}
+
+int record_steps(recorder *rec, grid *g, ant *a, rule *r,
+        unsigned long long *step_count, unsigned long long steps)
+{
+    /*
+     * Advance the ant a number of steps, recording the turn of each one.
+     * Write errors are kept until close_recorder.
+     *
+     * param rec - Recorder of the ant
+     * param g - Grid to be updated
+     * param a - Pointer to the ant
+     * param r - Pointer to the compiled rule that describes ant behavior
+     * param step_count - Pointer to the ant's step count, advanced by the
+     *   number of steps taken
+     * param steps - Number of steps to advance
+     * return - 0 on success, -1 if memory could not be allocated
+     */
+    for (unsigned long long i = 0; i < steps; i++) {
+        int dir = a->dir;
+
+        if (update_grid(g, a, r) != 0) {
+            return -1;
+        }
+        rec->turns[rec->count / 4] |= ((a->dir - dir) & 3) <<
+            (rec->count % 4 * 2);
+        rec->count++;
+        (*step_count)++;
+        if (*step_count % rec->keyframe_interval == 0) {
+            flush_moves(rec);
+            write_keyframe(rec, g, a, r, *step_count);
+        } else if (rec->count == BLOCK_STEPS) {
+            flush_moves(rec);
+        }
+        if (rec->count == 0) {
+            rec->block_step = *step_count;
+            rec->block_ant = *a;
+        }
+    }
+    return 0;
+}
+
+int replay_trajectory(char *path, unsigned long long step, grid *g, ant *a,
+        rule *r, char *start_dir, unsigned long long *step_count)
+{
+    /*
+     * Rebuild the world at a step of a recorded trajectory. The file is
+     * mapped into memory, the last keyframe at or before the step is
+     * loaded, and only the moves after it are applied.
+     *
+     * param path - Path of the trajectory file
+     * param step - Step to rebuild
+     * param g - Grid to load into. Must not hold any memory; on failure it
+     *   is left holding none
+     * param a - Ant to restore
+     * param r - Rule to compile from the recording
+     * param start_dir - Pointer to the ant's direction at step 0
+     * param step_count - Pointer to the step reached, which is earlier than
+     *   step if the recording ends first
+     * return - 0 on success, -1 if the file could not be read, is not a
+     *   valid trajectory or does not reach back to step
+     */
+    trajectory_header h;
+    record_header rh;
+    struct stat st;
+    unsigned char *data, *p, *end, *key = NULL;
+    unsigned char turns[BLOCK_STEPS / 4];
+    size_t key_len = 0;
+    int status = 0;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(h)) {
+        close(fd);
+        return -1;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    memcpy(&h, data, sizeof(h));
+    if (memcmp(h.magic, TRAJECTORY_MAGIC, sizeof(h.magic)) != 0 ||
+            h.version != TRAJECTORY_VERSION ||
+            h.byte_order != TRAJECTORY_BYTE_ORDER) {
+        munmap(data, st.st_size);
+        return -1;
+    }
+
+    // Skip from record to record to the last keyframe at or before step
+    end = data + st.st_size;
+    for (p = data + sizeof(h); end - p >= (long) sizeof(rh);
+            p += sizeof(rh) + (rh.length + 7) / 8 * 8) {
+        memcpy(&rh, p, sizeof(rh));
+        if (rh.step > step || (size_t) (end - p) - sizeof(rh) < rh.length) {
+            break;
+        }
+        if (rh.type == RECORD_KEYFRAME) {
+            key = p;
+            key_len = rh.length;
+        }
+    }
+    if (key == NULL || read_snapshot(key + sizeof(rh), key_len, g, a, r,
+                start_dir, step_count) != 0) {
+        munmap(data, st.st_size);
+        return -1;
+    }
+
+    // Apply the moves recorded after the keyframe
+    for (p = key; *step_count < step && end - p >= (long) sizeof(rh);
+            p += sizeof(rh) + (rh.length + 7) / 8 * 8) {
+        moves_header m;
+        unsigned long long n;
+
+        memcpy(&rh, p, sizeof(rh));
+        if ((size_t) (end - p) - sizeof(rh) < rh.length) {
+            break;
+        }
+        if (rh.type != RECORD_MOVES) {
+            continue;
+        }
+        if (rh.length < sizeof(m)) {
+            status = -1;
+            break;
+        }
+        memcpy(&m, p + sizeof(rh), sizeof(m));
+        if (rh.step != *step_count || m.steps == 0 ||
+                m.steps > BLOCK_STEPS || m.ant_y != a->pos.y ||
+                m.ant_x != a->pos.x || m.ant_dir != a->dir ||
+                unpack_runs(p + sizeof(rh) + sizeof(m),
+                    rh.length - sizeof(m), turns,
+                    (m.steps + 3) / 4) != 0) {
+            status = -1;
+            break;
+        }
+        n = step - *step_count < m.steps ? step - *step_count : m.steps;
+        if (apply_moves(g, a, r, turns, n) != 0) {
+            status = -1;
+            break;
+        }
+        *step_count += n;
+    }
+    munmap(data, st.st_size);
+    if (status != 0) {
+        free_grid(g);
+    }
+    return status;
+}
@@ -0,0 +1,78 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+/*
+ * trajectory.h
+ *
+ * Recording of every move of an ant to a file, and replay of the file to
+ * rebuild the world at any recorded step.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ant.h"
+#include "grid.h"
+#include "rule.h"
+
+#define TRAJECTORY_MAGIC "LANTTRAJ"
+#define TRAJECTORY_VERSION 1
+#define TRAJECTORY_BYTE_ORDER 0x01020304u
+// Steps per move record, packed four to a byte before run-length coding
+#define BLOCK_STEPS 65536
+#define DEFAULT_KEYFRAME_INTERVAL 16777216ULL
+
+#define RECORD_KEYFRAME 'K'
+#define RECORD_MOVES 'M'
+
+/*
+ * A trajectory file is this header followed by records, each padded to a
+ * multiple of 8 bytes. A keyframe record holds a snapshot of the world at
+ * its step. A move record holds the ant's state at its step and the turn
+ * it made on each step after that, 2 bits per step (0 none, 1 right,
+ * 2 u-turn, 3 left), run-length coded. Keyframes are written when
+ * recording starts and every keyframe_interval steps, so replay only
+ * needs to apply the moves after the nearest one.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t keyframe_interval;
+} trajectory_header;
+
+typedef struct {
+    uint32_t type;
+    // Bytes of data after this header, before padding
+    uint32_t length;
+    uint64_t step;
+} record_header;
+
+typedef struct {
+    int32_t ant_y, ant_x, ant_dir;
+    uint32_t steps;
+} moves_header;
+
+typedef struct {
+    FILE *f;
+    char start_dir;
+    unsigned long long keyframe_interval;
+    // Turns of the current move record and the ant's state before them
+    unsigned char turns[BLOCK_STEPS / 4];
+    unsigned char packed[BLOCK_STEPS / 4 + BLOCK_STEPS / 512 + 1];
+    unsigned int count;
+    unsigned long long block_step;
+    ant block_ant;
+    int failed;
+} recorder;
+
+int close_recorder(recorder *rec);
+int open_recorder(recorder *rec, char *path, grid *g, ant *a, rule *r,
+        char start_dir, unsigned long long step_count,
+        unsigned long long keyframe_interval);
+int record_steps(recorder *rec, grid *g, ant *a, rule *r,
+        unsigned long long *step_count, unsigned long long steps);
+int replay_trajectory(char *path, unsigned long long step, grid *g, ant *a,
+        rule *r, char *start_dir, unsigned long long *step_count);
+
+#endif